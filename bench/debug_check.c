@@ -0,0 +1,130 @@
+/*
+ * debug_check.c - Call sites reported by SCOPED_ENABLE_DEBUG
+ *
+ * Frees blocks twice through the public helpers and checks that the report
+ * names the lines in this file, not lines inside scoped.h.
+ * `make -C bench check-debug` builds and runs it.
+ */
+
+#define SCOPED_ENABLE_DEBUG
+#include "../scoped.h"
+
+#define DEBUG_CHECK(cond)                                                            \
+    do {                                                                             \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+static char report[4096];
+
+/* Run the double frees with stderr sent to a temporary file, then read it back */
+static void capture(void (*run)(void))
+{
+    FILE* log = tmpfile();
+    int saved = dup(2);
+    size_t n;
+
+    DEBUG_CHECK(log && saved >= 0);
+    dup2(fileno(log), 2);
+    run();
+    dup2(saved, 2);
+    close(saved);
+
+    rewind(log);
+    n = fread(report, 1, sizeof(report) - 1, log);
+    report[n] = '\0';
+    fclose(log);
+}
+
+/* The report for the double free of a block allocated at alloc and freed at freed, with freed == 0 for scope exit */
+static int reported(int again, int alloc, int freed)
+{
+    char expected[256];
+
+    if (freed)
+    {
+        snprintf(expected, sizeof(expected), " at %s:%d, allocated at %s:%d, freed at %s:%d\n",
+                 __FILE__, again, __FILE__, alloc, __FILE__, freed);
+    }
+    else
+    {
+        snprintf(expected, sizeof(expected), " at %s:%d, allocated at %s:%d, freed at scope exit\n",
+                 __FILE__, again, __FILE__, alloc);
+    }
+    return strstr(report, expected) != NULL;
+}
+
+static int line_malloc, line_free, line_again;
+
+static void free_twice(void)
+{
+    char* block = scoped_malloc(char, 16);  line_malloc = __LINE__;
+    scoped_free(block);                     line_free = __LINE__;
+    scoped_free(block);                     line_again = __LINE__;
+}
+
+static int line_push, line_buf_free, line_buf_again;
+
+static void buf_free_twice(void)
+{
+    scoped_buf(int) values = NULL;
+    int* raw;
+
+    scoped_buf_push(values, 1);             line_push = __LINE__;
+    raw = SCOPED_RELEASE(values);
+    scoped_buf_free(raw);                   line_buf_free = __LINE__;
+    scoped_buf_free(raw);                   line_buf_again = __LINE__;
+}
+
+static int line_append, line_str_free, line_str_again;
+
+static void strbuf_free_twice(void)
+{
+    scoped_strbuf line = SCOPED_STRBUF_INIT;
+    char text[SCOPED_STRBUF_INLINE * 2];
+    char* detached;
+
+    memset(text, 'x', sizeof(text));
+    scoped_strbuf_append_n(&line, text, sizeof(text));     line_append = __LINE__;
+    detached = scoped_strbuf_detach(&line);
+    scoped_free(detached);                  line_str_free = __LINE__;
+    scoped_free(detached);                  line_str_again = __LINE__;
+}
+
+static int line_scoped, line_scope_again;
+
+static void scope_exit_then_free(void)
+{
+    char* raw;
+    {
+        scoped_char_p owned = scoped_malloc(char, 16);  line_scoped = __LINE__;
+        raw = owned;
+    }
+    scoped_free(raw);                       line_scope_again = __LINE__;
+}
+
+static void run_all(void)
+{
+    free_twice();
+    buf_free_twice();
+    strbuf_free_twice();
+    scope_exit_then_free();
+}
+
+int main(void)
+{
+    capture(run_all);
+
+    DEBUG_CHECK(reported(line_again, line_malloc, line_free));
+    DEBUG_CHECK(reported(line_buf_again, line_push, line_buf_free));
+    DEBUG_CHECK(reported(line_str_again, line_append, line_str_free));
+    DEBUG_CHECK(reported(line_scope_again, line_scoped, 0));
+    DEBUG_CHECK(!strstr(report, "scoped.h"));
+    DEBUG_CHECK(scoped_debug_report(NULL) == 0);
+
+    puts("check-debug: double frees report the caller's lines");
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * inline_check.c - Codegen check for scoped.h cleanups
+ *
+ * Each scoped function is paired with its hand-written equivalent. At -O2 the
+ * cleanup helpers must be inlined, so the generated assembly may not contain
+ * calls to any _SCOPED_* function. `make -C bench check-inline` verifies this
+ * and prints the size of each pair.
+ */
+
+#include "../scoped.h"
+
+int scoped_heap(size_t n)
+{
+    scoped_int_p values = scoped_malloc(int, n);
+    if (!values) return -1;
+    values[0] = 42;
+    return values[0];
+}
+
+int manual_heap(size_t n)
+{
+    int* values = malloc(n * sizeof(int));
+    int result;
+    if (!values) return -1;
+    values[0] = 42;
+    result = values[0];
+    free(values);
+    return result;
+}
+
+int scoped_file(const char* path)
+{
+    scoped_file_p f = fopen(path, "r");
+    if (!f) return -1;
+    return fgetc(f);
+}
+
+int manual_file(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    int result;
+    if (!f) return -1;
+    result = fgetc(f);
+    fclose(f);
+    return result;
+}
+
+#if SCOPED_HAS_UNISTD
+int scoped_descriptor(int fd)
+{
+    scoped_fd owned = dup(fd);
+    if (owned < 0) return -1;
+    return (int)write(owned, "x", 1);
+}
+
+int manual_descriptor(int fd)
+{
+    int owned = dup(fd);
+    int result;
+    if (owned < 0) return -1;
+    result = (int)write(owned, "x", 1);
+    close(owned);
+    return result;
+}
+#endif
+
+int scoped_arena_use(size_t n)
+{
+    scoped_arena arena = scoped_arena_init(0);
+    int* values = scoped_arena_alloc(&arena, int, n);
+    if (!values) return -1;
+    values[0] = 42;
+    return values[0];
+}
+
+int scoped_deferred_call(size_t n)
+{
+    char* line = malloc(n);
+    SCOPED_DEFER(free, line);
+    if (!line) return -1;
+    line[0] = 'x';
+    return line[0];
+}
+
+int manual_deferred_call(size_t n)
+{
+    char* line = malloc(n);
+    int result;
+    if (!line) return -1;
+    line[0] = 'x';
+    result = line[0];
+    free(line);
+    return result;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+int scoped_deferred_fclose(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    SCOPED_DEFER(fclose, f);
+    return fgetc(f);
+}
+
+int manual_deferred_fclose(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    int result;
+    if (!f) return -1;
+    result = fgetc(f);
+    fclose(f);
+    return result;
+}
+
+int scoped_defer_block(int* counter)
+{
+    scoped_defer
+    {
+        (*counter)--;
+    }
+    (*counter) += 2;
+    return *counter;
+}
+
+int manual_defer_block(int* counter)
+{
+    int result;
+    (*counter) += 2;
+    result = *counter;
+    (*counter)--;
+    return result;
+}
+#endif
+
+int scoped_auto_file(const char* path)
+{
+    scoped_auto(f, fopen(path, "r"));
+    if (!f) return -1;
+    return fgetc(f);
+}
+
+#if SCOPED_HAS_UNISTD
+int scoped_auto_descriptor(int fd)
+{
+    scoped_auto(owned, SCOPED_FD(dup(fd)));
+    if (owned.fd < 0) return -1;
+    return (int)write(owned.fd, "x", 1);
+}
+#endif
@@ -0,0 +1,227 @@
+/*
+ * scoped_bench.c - Microbenchmarks for scoped.h
+ *
+ * Compares scoped types against manual resource management at several object
+ * sizes and thread counts. Build with the Makefile in this directory:
+ *
+ *   make -C bench run          # default allocation path
+ *   make -C bench run-tcache   # with SCOPED_ENABLE_THREAD_CACHE
+ */
+
+#define _GNU_SOURCE
+#include "../scoped.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define BENCH_ITERATIONS    1000000
+#define BENCH_MAX_THREADS   8
+
+typedef struct bench_node
+{
+    long key;
+    long value;
+    struct bench_node* next;
+} bench_node;
+
+SCOPED_REGISTER_POOL(bench_node, 1024)
+
+/* Keep the optimizer from discarding the work being measured */
+#define BENCH_ESCAPE(p) __asm__ __volatile__("" : : "g"(p) : "memory")
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void bench_report(const char* name, size_t size, int threads, double seconds, long ops)
+{
+    printf("%-28s %7zu B %3d thr %10.2f ns/op\n", name, size, threads, seconds * 1e9 / (double)ops);
+}
+
+static void bench_malloc_free(size_t size)
+{
+    for (long i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        char* p = malloc(size);
+        BENCH_ESCAPE(p);
+        free(p);
+    }
+}
+
+static void bench_scoped_malloc(size_t size)
+{
+    for (long i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        scoped_char_p p = scoped_malloc(char, size);
+        BENCH_ESCAPE(p);
+    }
+}
+
+static void bench_arena(size_t size)
+{
+    scoped_arena arena = scoped_arena_init(0);
+
+    for (long i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        char* p = scoped_arena_alloc(&arena, char, size);
+        BENCH_ESCAPE(p);
+        if ((i & 63) == 63)
+        {
+            scoped_arena_reset(&arena); // One request worth of allocations
+        }
+    }
+}
+
+static void bench_pool(size_t size)
+{
+    (void)size;
+    for (long i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        scoped_pool_p(bench_node) node = scoped_pool_alloc(bench_node);
+        BENCH_ESCAPE(node);
+    }
+}
+
+static void bench_manual_node(size_t size)
+{
+    (void)size;
+    for (long i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        bench_node* node = malloc(sizeof(bench_node));
+        BENCH_ESCAPE(node);
+        free(node);
+    }
+}
+
+static void bench_transfer(size_t size)
+{
+    scoped_char_p owner = scoped_malloc(char, size);
+
+    for (long i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        scoped_char_p tmp = NULL;
+        SCOPED_TRANSFER(tmp, owner);
+        BENCH_ESCAPE(tmp);
+        owner = SCOPED_RELEASE(tmp);
+    }
+}
+
+static void bench_raw_transfer(size_t size)
+{
+    char* owner = malloc(size);
+
+    for (long i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        char* tmp = owner;
+        owner = NULL;
+        BENCH_ESCAPE(tmp);
+        owner = tmp;
+    }
+    free(owner);
+}
+
+static void bench_realloc_growth(size_t size)
+{
+    long count = BENCH_ITERATIONS / 10;
+    scoped_char_p data = NULL;
+
+    for (long i = 0; i < count; i++)
+    {
+        if (!scoped_realloc(data, (size_t)(i + 1) * size))
+        {
+            return;
+        }
+        data[(size_t)i * size] = 1;
+    }
+    BENCH_ESCAPE(data);
+}
+
+static void bench_buf_growth(size_t size)
+{
+    long count = BENCH_ITERATIONS / 10;
+    scoped_buf(char) data = NULL;
+
+    if (!scoped_buf_reserve(data, 1))
+    {
+        return;
+    }
+    for (long i = 0; i < count; i++)
+    {
+        if (!scoped_buf_reserve(data, (size_t)(i + 1) * size))
+        {
+            return;
+        }
+        data[(size_t)i * size] = 1;
+    }
+    BENCH_ESCAPE(data);
+}
+
+typedef void (*bench_fn)(size_t size);
+
+typedef struct bench_job
+{
+    bench_fn fn;
+    size_t size;
+} bench_job;
+
+static void* bench_thread(void* arg)
+{
+    bench_job* job = arg;
+    job->fn(job->size);
+    scoped_thread_cache_flush();
+    return NULL;
+}
+
+static void bench_run(const char* name, bench_fn fn, size_t size, int threads, long ops)
+{
+    pthread_t tids[BENCH_MAX_THREADS];
+    bench_job job = { fn, size };
+    double start = bench_now();
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&tids[i], NULL, bench_thread, &job);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    bench_report(name, size, threads, bench_now() - start, ops * threads);
+}
+
+int main(void)
+{
+    static const size_t sizes[] = { 16, 256, 4096 };
+    static const int threads[] = { 1, 2, 4, 8 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+        {
+            bench_run("malloc/free", bench_malloc_free, sizes[s], threads[t], BENCH_ITERATIONS);
+            bench_run("scoped_malloc", bench_scoped_malloc, sizes[s], threads[t], BENCH_ITERATIONS);
+            bench_run("scoped_arena_alloc", bench_arena, sizes[s], threads[t], BENCH_ITERATIONS);
+        }
+    }
+
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+    {
+        bench_run("malloc/free node", bench_manual_node, sizeof(bench_node), threads[t], BENCH_ITERATIONS);
+        bench_run("scoped_pool_alloc node", bench_pool, sizeof(bench_node), threads[t], BENCH_ITERATIONS);
+    }
+
+    bench_run("raw pointer transfer", bench_raw_transfer, 64, 1, BENCH_ITERATIONS);
+    bench_run("SCOPED_TRANSFER/RELEASE", bench_transfer, 64, 1, BENCH_ITERATIONS);
+
+    for (size_t s = 0; s < 2; s++)
+    {
+        bench_run("scoped_realloc growth", bench_realloc_growth, sizes[s], 1, BENCH_ITERATIONS / 10);
+        bench_run("scoped_buf growth", bench_buf_growth, sizes[s], 1, BENCH_ITERATIONS / 10);
+    }
+
+    return 0;
+}
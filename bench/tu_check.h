@@ -0,0 +1,52 @@
+/*
+ * tu_check.h - Shared declarations for the cross-translation-unit check
+ *
+ * tu_check_a.c and tu_check_b.c both include scoped.h and this header, then
+ * hand resources back and forth. Per-thread and global state must be one
+ * object for the whole program, not one copy per translation unit.
+ * `make -C bench check-tu` builds and runs the pair with the thread cache
+ * enabled, so its magazines are exercised as well.
+ */
+
+#ifndef TU_CHECK_H
+#define TU_CHECK_H
+
+/* Small limits, so a thread that claims more than one slot runs out */
+#define SCOPED_EPOCH_MAX_THREADS    2
+#define SCOPED_HAZARD_MAX_THREADS   2
+#define SCOPED_HAZARD_SLOTS         1
+#define SCOPED_ENABLE_ZONES
+
+#include "../scoped.h"
+
+typedef struct tu_node
+{
+    int value;
+    struct tu_node* next;
+} tu_node;
+
+SCOPED_REGISTER_POOL(tu_node, 16)
+
+/* Defined in tu_check_b.c */
+void tu_b_pool_free(tu_node* node);
+tu_node* tu_b_pool_alloc(void);
+void tu_b_free(void* ptr);
+int tu_b_epoch_same(const void* guard);
+int tu_b_hazard_free_slot(void** src);
+void tu_b_zone(void);
+void tu_b_uninit_free(void* ptr);
+void tu_b_deferred_free(char* ptr);
+#if SCOPED_HAS_PTHREAD
+int tu_b_task(scoped_thread_pool_t* pool);
+#endif
+
+#define TU_CHECK(cond)                                                               \
+    do {                                                                             \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * tu_check_a.c - Cross-translation-unit check, see tu_check.h
+ */
+
+#include "tu_check.h"
+
+static void check_pool(void)
+{
+    tu_node* node = scoped_pool_alloc(tu_node);
+    tu_node* again;
+
+    TU_CHECK(node);
+    tu_b_pool_free(node);           // Returned through the other unit's code
+    again = tu_b_pool_alloc();
+    TU_CHECK(again == node);        // Same per-thread pool in both units
+    scoped_pool_free(tu_node, again);
+}
+
+static void check_thread_cache(void)
+{
+    char* block = scoped_malloc(char, 64);
+    char* again;
+
+    TU_CHECK(block);
+    tu_b_free(block);               // Lands in the other unit's view of the cache
+    again = scoped_malloc(char, 64);
+    TU_CHECK(again == block);       // One set of magazines per thread
+    scoped_free(again);
+}
+
+static void check_epoch(void)
+{
+    scoped_epoch_guard guard = scoped_epoch_enter();
+
+    TU_CHECK(guard);
+    TU_CHECK(tu_b_epoch_same(guard));   // One slot per thread in both units
+}
+
+static void check_hazard(void)
+{
+    int value = 1;
+    void* shared = &value;
+
+    {
+        scoped_hazard_p(void) held = scoped_hazard_protect(&shared);
+        TU_CHECK(held);
+        TU_CHECK(!tu_b_hazard_free_slot(&shared));  // The only slot is taken in this unit
+    }
+    TU_CHECK(tu_b_hazard_free_slot(&shared));       // and free again once released
+}
+
+static void check_uninit(void)
+{
+    char* block = scoped_uninit_malloc(char, 1 << 16);
+    char* again;
+
+    TU_CHECK(block);
+    tu_b_uninit_free(block);        // Cached on behalf of the whole thread
+    again = scoped_uninit_malloc(char, 1 << 16);
+    TU_CHECK(again == block);
+    scoped_uninit_free(again);
+}
+
+static void check_deferred(void)
+{
+    tu_b_deferred_free(scoped_malloc(char, 32));    // Queued in the other unit's view of the batch
+    TU_CHECK(scoped_reclaim() == 1);                // and published by this unit's flush
+}
+
+static void record_zones(void)
+{
+    scoped_zone("a");
+    tu_b_zone();
+}
+
+/* Export the zones and return how many threads they came from */
+static int export_zones(size_t* written)
+{
+    scoped_file_p trace = tmpfile();
+    char line[256];
+    int threads = 0;
+    int last = 0;
+
+    TU_CHECK(trace);
+    *written = scoped_zone_export_chrome(trace);
+    rewind(trace);
+    while (fgets(line, sizeof(line), trace))
+    {
+        const char* tid = strstr(line, "\"tid\":");
+        if (tid && atoi(tid + 6) != last)
+        {
+            last = atoi(tid + 6);
+            threads++;
+        }
+    }
+    return threads;
+}
+
+#if SCOPED_HAS_PTHREAD
+static void* pool_free_thread(void* arg)
+{
+    tu_b_pool_free(arg);
+    return NULL;
+}
+
+static void* pool_alloc_thread(void* arg)
+{
+    (void)arg;
+    return tu_b_pool_alloc();
+}
+
+static void check_pool_remote(void)
+{
+    tu_node* held[16];
+    tu_node* again;
+    pthread_t thread;
+    void* orphan;
+    int i;
+
+    for (i = 0; i < 16; i++)        // Every slot of this thread's pool
+    {
+        held[i] = scoped_pool_alloc(tu_node);
+    }
+    TU_CHECK(pthread_create(&thread, NULL, pool_free_thread, held[0]) == 0);
+    pthread_join(thread, NULL);
+    again = scoped_pool_alloc(tu_node);
+    TU_CHECK(again == held[0]);     // Returned on another thread, back in this pool
+    for (i = 0; i < 16; i++)
+    {
+        scoped_pool_free(tu_node, held[i]);
+    }
+
+    TU_CHECK(pthread_create(&thread, NULL, pool_alloc_thread, NULL) == 0);
+    pthread_join(thread, &orphan);
+    TU_CHECK(orphan);
+    scoped_pool_free(tu_node, (tu_node*)orphan);    // Its pool goes with its last object
+}
+
+static scoped_thread_pool_t* task_pool;
+static int on_worker;
+
+static void pool_task(void* arg)
+{
+    (void)arg;
+    if (tu_b_task(task_pool))
+    {
+        __atomic_add_fetch(&on_worker, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void check_thread_pool(void)
+{
+    scoped_thread_pool pool = scoped_thread_pool_create(2);
+    TU_CHECK(pool);
+    task_pool = pool;
+    {
+        scoped_task_group group = scoped_task_group_init(pool);
+        int i;
+        for (i = 0; i < 8; i++)
+        {
+            scoped_task_spawn(&group, pool_task, NULL);
+        }
+    }
+    TU_CHECK(on_worker > 0);        // The other unit sees the worker it runs on
+}
+
+static void* pool_thread(void* arg)
+{
+    (void)arg;
+    check_pool();
+    check_thread_cache();
+    check_epoch();
+    check_hazard();
+    check_uninit();
+    tu_b_deferred_free(scoped_malloc(char, 32));    // Left in a partial batch at exit
+    record_zones();
+    return NULL;
+}
+#endif
+
+int main(void)
+{
+    check_pool();
+    check_thread_cache();
+    check_epoch();
+    check_hazard();
+    check_uninit();
+    check_deferred();
+    record_zones();
+#if SCOPED_HAS_PTHREAD
+    {
+        size_t written;
+        int i;
+        for (i = 0; i < 3; i++)     // Each exiting thread must hand its slots back
+        {
+            pthread_t thread;
+            TU_CHECK(pthread_create(&thread, NULL, pool_thread, NULL) == 0);
+            pthread_join(thread, NULL);
+        }
+        check_pool_remote();
+        TU_CHECK(scoped_reclaim() == 3);        // Published by each thread as it exited
+        check_thread_pool();
+        TU_CHECK(export_zones(&written) == 4);  // One ring per thread for both units
+        TU_CHECK(written == 8);
+        TU_CHECK(export_zones(&written) == 1);  // Exited threads' rings are gone
+        TU_CHECK(written == 2);
+    }
+#endif
+
+    puts("check-tu: state shared across translation units");
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * tu_check_b.c - Second translation unit of the cross-translation-unit check
+ */
+
+#include <time.h>
+
+#include "tu_check.h"
+
+void tu_b_pool_free(tu_node* node)
+{
+    scoped_pool_free(tu_node, node);
+}
+
+tu_node* tu_b_pool_alloc(void)
+{
+    return scoped_pool_alloc(tu_node);
+}
+
+void tu_b_free(void* ptr)
+{
+    scoped_free(ptr);
+}
+
+int tu_b_epoch_same(const void* guard)
+{
+    scoped_epoch_guard mine = scoped_epoch_enter();
+    return mine && mine == guard;
+}
+
+int tu_b_hazard_free_slot(void** src)
+{
+    scoped_hazard_p(void) held = scoped_hazard_protect(src);
+    return held != NULL;
+}
+
+void tu_b_zone(void)
+{
+    scoped_zone("b");
+}
+
+void tu_b_uninit_free(void* ptr)
+{
+    scoped_uninit_free(ptr);
+}
+
+void tu_b_deferred_free(char* ptr)
+{
+    scoped_deferred_p(char) queued = ptr;
+    (void)queued;
+}
+
+static void tu_b_leaf(void* arg)
+{
+    __atomic_add_fetch((int*)arg, 1, __ATOMIC_RELAXED);
+}
+
+/* Runs on the pool created in the other unit, returns nonzero on one of its workers */
+int tu_b_task(scoped_thread_pool_t* pool)
+{
+    struct timespec pause = { 0, 1000000 };
+    int done = 0;
+
+    nanosleep(&pause, NULL);    // Lets the workers pick up the other tasks
+    {
+        scoped_task_group group = scoped_task_group_init(pool);
+        int i;
+        for (i = 0; i < 64; i++)
+        {
+            scoped_task_spawn(&group, tu_b_leaf, &done);
+        }
+    }
+    TU_CHECK(done == 64);
+    return _scoped_worker_pool == pool;
+}
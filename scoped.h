@@ -60,10 +60,43 @@
 	#else
 		#define SCOPED_HAS_SOCKETS 0
 	#endif
+
+	/* Check if we have memory-mapped file support */
+	#if defined(_POSIX_MAPPED_FILES) || defined(__linux__) || defined(__APPLE__)
+		#include <sys/mman.h>
+		#include <sys/stat.h>
+		#include <fcntl.h>
+		#define SCOPED_HAS_MMAP 1
+	#else
+		#define SCOPED_HAS_MMAP 0
+	#endif
+
+	/* Check if we have POSIX threads */
+	#if defined(_POSIX_THREADS) && _POSIX_THREADS > 0
+		#include <pthread.h>
+		#include <sched.h>
+		#define SCOPED_HAS_PTHREAD 1
+	#else
+		#define SCOPED_HAS_PTHREAD 0
+	#endif
+
+	/* Check if io_uring support is requested and liburing is available */
+	#if defined(SCOPED_ENABLE_IO_URING) && defined(__linux__) && defined(__has_include)
+		#if __has_include(<liburing.h>)
+			#include <liburing.h>
+			#define SCOPED_HAS_IO_URING 1
+		#endif
+	#endif
+	#ifndef SCOPED_HAS_IO_URING
+		#define SCOPED_HAS_IO_URING 0
+	#endif
 #else
 	/* Not a POSIX system */
 	#define SCOPED_HAS_UNISTD 0
 	#define SCOPED_HAS_SOCKETS 0
+	#define SCOPED_HAS_MMAP 0
+	#define SCOPED_HAS_PTHREAD 0
+	#define SCOPED_HAS_IO_URING 0
 #endif
 
 /* Allow user to override the default malloc function */
@@ -86,6 +119,36 @@
 	#define SCOPED_FREE_FUNC    free
 #endif
 
+/* Allow user to override the default sized free function (free_sized, sdallocx...) */
+#ifndef SCOPED_FREE_SIZED_FUNC
+	#define SCOPED_FREE_SIZED_FUNC(ptr, size)   ((void)(size), SCOPED_FREE_FUNC(ptr))
+#endif
+
+/* Allow user to override the default aligned malloc function, called as FUNC(size, align) */
+#ifndef SCOPED_ALIGNED_MALLOC_FUNC
+	#if defined(_WIN32)
+		#include <malloc.h>
+		#define SCOPED_ALIGNED_MALLOC_FUNC  _aligned_malloc
+		#define SCOPED_ALIGNED_FREE_FUNC    _aligned_free
+	#elif defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L
+		#define SCOPED_ALIGNED_MALLOC_FUNC  _SCOPED_posix_memalign
+		#define SCOPED_ALIGNED_FREE_FUNC    free
+	#else
+		#define SCOPED_ALIGNED_MALLOC_FUNC  _SCOPED_fallback_aligned_malloc
+		#define SCOPED_ALIGNED_FREE_FUNC    _SCOPED_fallback_aligned_free
+	#endif
+#endif
+
+/* Allow user to override the default aligned free function */
+#ifndef SCOPED_ALIGNED_FREE_FUNC
+	#define SCOPED_ALIGNED_FREE_FUNC    free
+#endif
+
+/* Allow user to override the assumed cache line size */
+#ifndef SCOPED_CACHE_LINE_SIZE
+	#define SCOPED_CACHE_LINE_SIZE      64
+#endif
+
 #if defined(__GNUC__) || defined(__clang__)
     #define _SCOPED(FUNC)   __attribute__((cleanup(FUNC)))
 #else
@@ -93,245 +156,6556 @@
     #define _SCOPED(FUNC)
 #endif
 
-static inline void _SCOPED_free(void* p)
+/* Strictest fundamental alignment, used to lay out internal block headers */
+typedef union _scoped_max_align
 {
-    void** ptr = (void**)p;
-    if (*ptr)
+    long double ld;
+    long long   ll;
+    void*       p;
+    void        (*fp)(void);
+} _scoped_max_align;
+
+#define _SCOPED_MAX_ALIGN           __alignof__(_scoped_max_align)
+#define _SCOPED_ALIGN_UP(n, align)  (((n) + ((align) - 1)) & ~((size_t)(align) - 1))
+
+/* Shared definitions, merged by the linker so every translation unit sees the same object */
+#define _SCOPED_SHARED  __attribute__((weak))
+
+/* Per-thread teardown, run when a thread exits; the node is embedded in the state it frees */
+typedef struct _scoped_thread_exit_node
+{
+    void (*fn)(struct _scoped_thread_exit_node*);
+    struct _scoped_thread_exit_node* next;
+} _scoped_thread_exit_node;
+
+#if SCOPED_HAS_PTHREAD
+__thread _scoped_thread_exit_node* _scoped_thread_exit_list _SCOPED_SHARED = NULL;
+pthread_key_t _scoped_thread_exit_key _SCOPED_SHARED;
+pthread_once_t _scoped_thread_exit_once _SCOPED_SHARED = PTHREAD_ONCE_INIT;
+
+static inline void _SCOPED_thread_exit_run(void* unused)
+{
+    _scoped_thread_exit_node* node;
+
+    (void)unused;
+    while ((node = _scoped_thread_exit_list))
     {
-	    SCOPED_FREE_FUNC(*ptr);
-        *ptr = NULL;    // Prevent double-free
+        _scoped_thread_exit_list = node->next;
+        node->fn(node);
     }
 }
 
-static inline void _SCOPED_fclose(FILE** f)
+static inline void _SCOPED_thread_exit_init(void)
 {
-    if (*f)
+    pthread_key_create(&_scoped_thread_exit_key, _SCOPED_thread_exit_run);
+}
+
+/* Run fn(node) when the calling thread exits; the main thread's state is reclaimed by the process exit */
+static inline void _SCOPED_at_thread_exit(_scoped_thread_exit_node* node, void (*fn)(_scoped_thread_exit_node*))
+{
+    node->fn = fn;
+    pthread_once(&_scoped_thread_exit_once, _SCOPED_thread_exit_init);
+    node->next = _scoped_thread_exit_list;
+    _scoped_thread_exit_list = node;
+    pthread_setspecific(_scoped_thread_exit_key, node);  // Any non-NULL value arms the destructor
+}
+#else
+static inline void _SCOPED_at_thread_exit(_scoped_thread_exit_node* node, void (*fn)(_scoped_thread_exit_node*))
+{
+    node->fn = fn;
+    node->next = NULL;
+}
+#endif
+
+
+/*
+ * Optional thread-local allocation cache
+ *
+ * When SCOPED_ENABLE_THREAD_CACHE is defined, scoped_malloc, scoped_calloc, scoped_realloc
+ * and the scoped pointer cleanups go through per-thread, size-class magazines that are
+ * refilled from and drained to the SCOPED_*_FUNC allocator in batches.
+ *
+ * Every block carries a small header, so memory owned by scoped pointers must come from
+ * the scoped_* allocation macros and released pointers must be freed with scoped_free.
+ * The magazines are one thread-local object for the whole program, flushed when the thread exits.
+ */
+#ifdef SCOPED_ENABLE_THREAD_CACHE
+
+/* Allow user to override the number of size classes (16, 32, 64... bytes), the same in every translation unit */
+#ifndef SCOPED_THREAD_CACHE_CLASSES
+    #define SCOPED_THREAD_CACHE_CLASSES     10
+#endif
+
+/* Allow user to override the number of blocks cached per size class */
+#ifndef SCOPED_THREAD_CACHE_MAGAZINE
+    #define SCOPED_THREAD_CACHE_MAGAZINE    64
+#endif
+
+#define _SCOPED_TCACHE_MIN_SIZE     ((size_t)16)
+#define _SCOPED_TCACHE_MAX_SIZE     (_SCOPED_TCACHE_MIN_SIZE << (SCOPED_THREAD_CACHE_CLASSES - 1))
+#define _SCOPED_TCACHE_BATCH        (SCOPED_THREAD_CACHE_MAGAZINE / 2)
+#define _SCOPED_TCACHE_LARGE        SIZE_MAX
+
+typedef union _scoped_tcache_hdr
+{
+    size_t size_class;  // Magazine index, or _SCOPED_TCACHE_LARGE for uncached blocks
+    _scoped_max_align _align;
+} _scoped_tcache_hdr;
+
+typedef struct _scoped_tcache_bin
+{
+    size_t count;
+    void* blocks[SCOPED_THREAD_CACHE_MAGAZINE];
+} _scoped_tcache_bin;
+
+typedef struct _scoped_tcache_state
+{
+    _scoped_tcache_bin bins[SCOPED_THREAD_CACHE_CLASSES];
+    _scoped_thread_exit_node exit;
+    int registered;     // Flushed automatically when the thread exits
+} _scoped_tcache_state;
+
+/* Magazines of the calling thread, shared by every translation unit */
+__thread _scoped_tcache_state _scoped_tcache _SCOPED_SHARED;
+
+#define _SCOPED_TCACHE_HDR(ptr)     ((_scoped_tcache_hdr*)(ptr) - 1)
+#define _SCOPED_TCACHE_CLASS_SIZE(c) (_SCOPED_TCACHE_MIN_SIZE << (c))
+
+/* Smallest class that holds size, which must not exceed _SCOPED_TCACHE_MAX_SIZE */
+static inline size_t _SCOPED_tcache_class(size_t size)
+{
+    return size <= _SCOPED_TCACHE_MIN_SIZE ? 0 : (size_t)(64 - __builtin_clzll((unsigned long long)size - 1)) - 4;
+}
+
+static inline void scoped_thread_cache_flush(void);
+
+static inline void _SCOPED_tcache_exit(_scoped_thread_exit_node* node)
+{
+    (void)node;
+    scoped_thread_cache_flush();
+    _scoped_tcache.registered = 0;  // Blocks freed by later exit handlers register again
+}
+
+/* Flush the magazines at thread exit, installed whenever an empty magazine gains blocks */
+static inline void _SCOPED_tcache_register(void)
+{
+    if (!_scoped_tcache.registered)
     {
-        fclose(*f);
-        *f = NULL;  // Prevent double-close
+        _scoped_tcache.registered = 1;
+        _SCOPED_at_thread_exit(&_scoped_tcache.exit, _SCOPED_tcache_exit);
     }
 }
 
-/* File descriptor support */
-#if SCOPED_HAS_UNISTD
-static inline void _SCOPED_close(int* fd)
+/* Slow path: fetch a batch of blocks from the backing allocator */
+static inline int _SCOPED_tcache_refill(_scoped_tcache_bin* bin, size_t size_class)
 {
-    if (*fd >= 0)
+    size_t block_size = sizeof(_scoped_tcache_hdr) + _SCOPED_TCACHE_CLASS_SIZE(size_class);
+
+    _SCOPED_tcache_register();
+
+    while (bin->count < _SCOPED_TCACHE_BATCH)
     {
-        close(*fd);
-        *fd = -1;   // Prevent double-close
+        _scoped_tcache_hdr* hdr = SCOPED_MALLOC_FUNC(block_size);
+        if (!hdr)
+        {
+            break;
+        }
+        hdr->size_class = size_class;
+        bin->blocks[bin->count++] = hdr + 1;
     }
+
+    return bin->count > 0;
 }
-#endif
 
-/* Core C scalar pointer types */
-#define _SCOPED_VOID_FUNC       _SCOPED_free
-#define _SCOPED_CHAR_FUNC       _SCOPED_free
-#define _SCOPED_SHORT_FUNC      _SCOPED_free
-#define _SCOPED_INT_FUNC        _SCOPED_free
-#define _SCOPED_LONG_FUNC       _SCOPED_free
-#define _SCOPED_FLOAT_FUNC      _SCOPED_free
-#define _SCOPED_DOUBLE_FUNC     _SCOPED_free
-#define _SCOPED_LDOUBLE_FUNC    _SCOPED_free
+/* Slow path: hand the older half of a full magazine back to the backing allocator */
+static inline void _SCOPED_tcache_drain(_scoped_tcache_bin* bin)
+{
+    size_t i;
 
-/* Unsigned scalar pointer types */
-#define _SCOPED_UCHAR_FUNC      _SCOPED_free
-#define _SCOPED_USHORT_FUNC     _SCOPED_free
-#define _SCOPED_UINT_FUNC       _SCOPED_free
-#define _SCOPED_ULONG_FUNC      _SCOPED_free
-#define _SCOPED_ULLONG_FUNC     _SCOPED_free
+    for (i = 0; i < _SCOPED_TCACHE_BATCH; i++)
+    {
+        SCOPED_FREE_FUNC(_SCOPED_TCACHE_HDR(bin->blocks[i]));
+    }
 
-/* Fixed-width integer pointer types */
-#define _SCOPED_INT8_FUNC       _SCOPED_free
-#define _SCOPED_UINT8_FUNC      _SCOPED_free
-#define _SCOPED_INT16_FUNC      _SCOPED_free
-#define _SCOPED_UINT16_FUNC     _SCOPED_free
-#define _SCOPED_INT32_FUNC      _SCOPED_free
-#define _SCOPED_UINT32_FUNC     _SCOPED_free
-#define _SCOPED_INT64_FUNC      _SCOPED_free
-#define _SCOPED_UINT64_FUNC     _SCOPED_free
+    bin->count -= _SCOPED_TCACHE_BATCH;
+    memmove(bin->blocks, bin->blocks + _SCOPED_TCACHE_BATCH, bin->count * sizeof(void*));
+}
 
-/* Pointer-sized integer pointer types */
-#define _SCOPED_INTPTR_FUNC     _SCOPED_free
-#define _SCOPED_UINTPTR_FUNC    _SCOPED_free
+static inline void* _SCOPED_tcache_malloc(size_t size)
+{
+    _scoped_tcache_hdr* hdr;
 
-/* Other common standard integer types */
-#define _SCOPED_SIZE_FUNC       _SCOPED_free
-#define _SCOPED_SSIZE_FUNC      _SCOPED_free
-#define _SCOPED_PTRDIFF_FUNC    _SCOPED_free
+    if (size <= _SCOPED_TCACHE_MAX_SIZE)
+    {
+        size_t size_class = _SCOPED_tcache_class(size);
+        _scoped_tcache_bin* bin = &_scoped_tcache.bins[size_class];
 
-/* Standard library structs */
-#define _SCOPED_FILE_FUNC       _SCOPED_fclose
+        if (bin->count == 0 && !_SCOPED_tcache_refill(bin, size_class))
+        {
+            return NULL;
+        }
+        return bin->blocks[--bin->count];
+    }
 
-/* POSIX support */
-#if SCOPED_HAS_UNISTD
-    #define _SCOPED_FD_FUNC     _SCOPED_close
-#endif
+    if (size > SIZE_MAX - sizeof(_scoped_tcache_hdr))
+    {
+        return NULL;
+    }
 
-#if SCOPED_HAS_SOCKETS
-    #define _SCOPED_SOCKET_FUNC _SCOPED_close
-#endif
+    hdr = SCOPED_MALLOC_FUNC(sizeof(_scoped_tcache_hdr) + size);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->size_class = _SCOPED_TCACHE_LARGE;
+    return hdr + 1;
+}
 
-/* Type definitions */
-#define scoped_void_p		_SCOPED(_SCOPED_VOID_FUNC)      void*
-#define scoped_char_p		_SCOPED(_SCOPED_CHAR_FUNC)      char*
-#define scoped_short_p		_SCOPED(_SCOPED_SHORT_FUNC)     short*
-#define scoped_int_p		_SCOPED(_SCOPED_INT_FUNC)       int*
-#define scoped_long_p		_SCOPED(_SCOPED_LONG_FUNC)      long*
-#define scoped_float_p		_SCOPED(_SCOPED_FLOAT_FUNC)     float*
-#define scoped_double_p		_SCOPED(_SCOPED_DOUBLE_FUNC)    double*
-#define scoped_ldouble_p    _SCOPED(_SCOPED_LDOUBLE_FUNC)   long double*
+static inline void* _SCOPED_tcache_calloc(size_t count, size_t size)
+{
+    size_t total;
+    void* ptr;
 
-#define scoped_uchar_p		_SCOPED(_SCOPED_UCHAR_FUNC)     unsigned char*
-#define scoped_ushort_p		_SCOPED(_SCOPED_USHORT_FUNC)    unsigned short*
-#define scoped_uint_p		_SCOPED(_SCOPED_UINT_FUNC)      unsigned int*
-#define scoped_ulong_p		_SCOPED(_SCOPED_ULONG_FUNC)     unsigned long*
-#define scoped_ullong_p		_SCOPED(_SCOPED_ULLONG_FUNC)    unsigned long long*
+    if (__builtin_mul_overflow(count, size, &total))
+    {
+        return NULL;
+    }
 
-#define scoped_int8_p		_SCOPED(_SCOPED_INT8_FUNC)      int8_t*
-#define scoped_uint8_p		_SCOPED(_SCOPED_UINT8_FUNC)     uint8_t*
-#define scoped_int16_p		_SCOPED(_SCOPED_INT16_FUNC)     int16_t*
-#define scoped_uint16_p		_SCOPED(_SCOPED_UINT16_FUNC)    uint16_t*
-#define scoped_int32_p		_SCOPED(_SCOPED_INT32_FUNC)     int32_t*
-#define scoped_uint32_p		_SCOPED(_SCOPED_UINT32_FUNC)    uint32_t*
-#define scoped_int64_p		_SCOPED(_SCOPED_INT64_FUNC)     int64_t*
-#define scoped_uint64_p		_SCOPED(_SCOPED_UINT64_FUNC)    uint64_t*
+    if (total > _SCOPED_TCACHE_MAX_SIZE)
+    {
+        /* Large blocks keep the backing calloc so fresh pages are not zeroed twice */
+        _scoped_tcache_hdr* hdr;
 
-#define scoped_intptr_p		_SCOPED(_SCOPED_INTPTR_FUNC)    intptr_t*
-#define scoped_uintptr_p	_SCOPED(_SCOPED_UINTPTR_FUNC)   uintptr_t*
+        if (total > SIZE_MAX - sizeof(_scoped_tcache_hdr))
+        {
+            return NULL;
+        }
 
-#define scoped_size_p		_SCOPED(_SCOPED_SIZE_FUNC)      size_t*
-#define scoped_ssize_p		_SCOPED(_SCOPED_SSIZE_FUNC)     ssize_t*
-#define scoped_ptrdiff_p	_SCOPED(_SCOPED_PTRDIFF_FUNC)   ptrdiff_t*
+        hdr = SCOPED_CALLOC_FUNC(1, sizeof(_scoped_tcache_hdr) + total);
+        if (!hdr)
+        {
+            return NULL;
+        }
+        hdr->size_class = _SCOPED_TCACHE_LARGE;
+        return hdr + 1;
+    }
 
-#define scoped_file_p		_SCOPED(_SCOPED_FILE_FUNC)      FILE*
+    ptr = _SCOPED_tcache_malloc(total);
+    if (ptr)
+    {
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
 
-/* POSIX types */
-#if SCOPED_HAS_UNISTD
-    #define scoped_fd       _SCOPED(_SCOPED_FD_FUNC)        int
-#endif
+static inline void _SCOPED_tcache_free(void* ptr)
+{
+    _scoped_tcache_hdr* hdr;
+    _scoped_tcache_bin* bin;
 
-#if SCOPED_HAS_SOCKETS
-    #define scoped_socket   _SCOPED(_SCOPED_SOCKET_FUNC)    int
-#endif
+    if (!ptr)
+    {
+        return;
+    }
 
-/* Helper macros */
+    hdr = _SCOPED_TCACHE_HDR(ptr);
+    if (hdr->size_class == _SCOPED_TCACHE_LARGE)
+    {
+        SCOPED_FREE_FUNC(hdr);
+        return;
+    }
 
-/* Registration macro for user-defined types */
-#define SCOPED_REGISTER_CUSTOM_TYPE(T, FUNC)        \
-	static inline void _SCOPED_##T##_CUSTOM(T* p)   \
-	{											    \
-        FUNC(p);                                    \
-	}
+    bin = &_scoped_tcache.bins[hdr->size_class];
+    if (bin->count == SCOPED_THREAD_CACHE_MAGAZINE)
+    {
+        _SCOPED_tcache_drain(bin);
+    }
+    else if (__builtin_expect(bin->count == 0, 0))
+    {
+        _SCOPED_tcache_register();  // Threads that only free, like pool workers, flush too
+    }
+    bin->blocks[bin->count++] = ptr;
+}
 
-/* Registration macro for user-defined pointer types */
-#define SCOPED_REGISTER_CUSTOM_TYPE_PTR(T, FUNC)        \
-	static inline void _SCOPED_##T##_PTR_CUSTOM(T** p)  \
-	{											        \
-        if (*p)                                         \
-        {                                               \
-		    FUNC(*p);                                   \
-            *p = NULL;                                  \
-        }                                               \
-	}
+static inline void* _SCOPED_tcache_realloc(void* ptr, size_t size)
+{
+    _scoped_tcache_hdr* hdr;
+    size_t old_size;
+    void* new_ptr;
 
-/* Public macro for scoped user-defined type declaration */
-#define scoped(T)   _SCOPED(_SCOPED_##T##_CUSTOM) T
+    if (!ptr)
+    {
+        return _SCOPED_tcache_malloc(size);
+    }
 
-/* Public macro for scoped user-defined type pointer declaration */
-#define scoped_p(T) _SCOPED(_SCOPED_##T##_PTR_CUSTOM) T*
+    hdr = _SCOPED_TCACHE_HDR(ptr);
+    if (hdr->size_class == _SCOPED_TCACHE_LARGE && size > _SCOPED_TCACHE_MAX_SIZE)
+    {
+        if (size > SIZE_MAX - sizeof(_scoped_tcache_hdr))
+        {
+            return NULL;
+        }
 
-/**
- * Transfer ownership from one scoped variable to another
- * Sets source to NULL to prevent double-free
- * 
- * Example:
- *   scoped_int_t a = scoped_malloc(int, 10);
- *   scoped_int_t b = NULL;
- *   SCOPED_TRANSFER(b, a); // now b owns the memory, a is NULL
- */
-#define SCOPED_TRANSFER(dest, src)  \
-    do {                            \
-        (dest) = (src);             \
-        (src) = NULL;               \
-    } while(0)
+        hdr = SCOPED_REALLOC_FUNC(hdr, sizeof(_scoped_tcache_hdr) + size);
+        return hdr ? (void*)(hdr + 1) : NULL;
+    }
 
-/**
- * Transfer ownership from raw pointer to scoped variable
- * Sets source to NULL to prevent double-free
- * 
- * Example:
- *   int* raw = malloc(10 * sizeof(int));
- *   scoped_int_t scoped_arr = NULL;
- *   SCOPED_TAKE_OWNERSHIP(scoped_arr, raw); // now scoped_arr owns the memory
- */
-#define SCOPED_TAKE_OWNERSHIP(scoped_var, raw_ptr)  \
-    do {                                            \
-        (scoped_var) = (raw_ptr);                   \
-        (raw_ptr) = NULL;                           \
-    } while(0)
+    if (hdr->size_class != _SCOPED_TCACHE_LARGE)
+    {
+        old_size = _SCOPED_TCACHE_CLASS_SIZE(hdr->size_class);
+        if (size <= old_size && (hdr->size_class == 0 || size > old_size / 2))
+        {
+            return ptr; // Still fits its size class
+        }
+    }
+    else
+    {
+        old_size = size; // Shrinking a large block, the new size bounds the copy
+    }
+
+    new_ptr = _SCOPED_tcache_malloc(size);
+    if (!new_ptr)
+    {
+        return NULL;
+    }
+
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    _SCOPED_tcache_free(ptr);
+    return new_ptr;
+}
 
 /**
- * Release ownership from scoped variable to raw pointer
- * Sets scoped variable to NULL to prevent cleanup
+ * Release every block cached by the calling thread
+ * Runs automatically when a thread exits; call it to return memory earlier
  * 
  * Example:
- *   scoped_int_t scoped_arr = scoped_malloc(int, 10);
- *   int* raw = SCOPED_RELEASE(scoped_arr); // now you must manually free(raw)
+ *   run_batch(jobs);
+ *   scoped_thread_cache_flush(); // idle from here on
  */
-#define SCOPED_RELEASE(scoped_var)                              \
-    ({                                                          \
-        __typeof__(*(scoped_var))* _released = (scoped_var);    \
-        (scoped_var) = NULL;                                    \
-        _released;                                              \
-    })
+static inline void scoped_thread_cache_flush(void)
+{
+    size_t size_class;
 
-/**
- * Safe malloc using custom allocator
+    for (size_class = 0; size_class < SCOPED_THREAD_CACHE_CLASSES; size_class++)
+    {
+        _scoped_tcache_bin* bin = &_scoped_tcache.bins[size_class];
+        while (bin->count)
+        {
+            SCOPED_FREE_FUNC(_SCOPED_TCACHE_HDR(bin->blocks[--bin->count]));
+        }
+    }
+}
+
+    #define _SCOPED_BACKEND_MALLOC(size)        _SCOPED_tcache_malloc(size)
+    #define _SCOPED_BACKEND_CALLOC(count, size) _SCOPED_tcache_calloc((count), (size))
+    #define _SCOPED_BACKEND_REALLOC(ptr, size)  _SCOPED_tcache_realloc((ptr), (size))
+    #define _SCOPED_BACKEND_FREE(ptr)           _SCOPED_tcache_free(ptr)
+#else
+    #define scoped_thread_cache_flush()         ((void)0)
+
+    #define _SCOPED_BACKEND_MALLOC(size)        SCOPED_MALLOC_FUNC(size)
+    #define _SCOPED_BACKEND_CALLOC(count, size) SCOPED_CALLOC_FUNC((count), (size))
+    #define _SCOPED_BACKEND_REALLOC(ptr, size)  SCOPED_REALLOC_FUNC((ptr), (size))
+    #define _SCOPED_BACKEND_FREE(ptr)           SCOPED_FREE_FUNC(ptr)
+#endif
+
+
+/* Runtime allocator context, consulted by the scoped allocation functions when SCOPED_ENABLE_ALLOCATOR_CONTEXT is defined */
+#ifdef SCOPED_ENABLE_ALLOCATOR_CONTEXT
+
+/* Allocator vtable; resize may be NULL (allocate, copy, release) and so may release (memory reclaimed in bulk) */
+typedef struct scoped_allocator_t
+{
+    void* (*alloc)(void* self, size_t size);
+    void* (*resize)(void* self, void* ptr, size_t old_size, size_t new_size);
+    void (*release)(void* self, void* ptr, size_t size);
+    void* self;
+} scoped_allocator_t;
+
+typedef union _scoped_context_hdr
+{
+    struct
+    {
+        const scoped_allocator_t* owner;    // NULL for the default allocator
+        size_t size;
+    } info;
+    _scoped_max_align _align;
+} _scoped_context_hdr;
+
+/* Allocator of the calling thread, shared by every translation unit; NULL selects the default */
+__thread const scoped_allocator_t* _scoped_allocator_current _SCOPED_SHARED = NULL;
+
+static inline void* _SCOPED_context_tag(_scoped_context_hdr* hdr, const scoped_allocator_t* owner, size_t size)
+{
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->info.owner = owner;
+    hdr->info.size = size;
+    return hdr + 1;
+}
+
+static inline void* _SCOPED_context_malloc(size_t size)
+{
+    const scoped_allocator_t* owner = _scoped_allocator_current;
+
+    if (size > SIZE_MAX - sizeof(_scoped_context_hdr))
+    {
+        return NULL;
+    }
+    size += sizeof(_scoped_context_hdr);
+    return _SCOPED_context_tag(owner ? owner->alloc(owner->self, size) : _SCOPED_BACKEND_MALLOC(size),
+                               owner, size - sizeof(_scoped_context_hdr));
+}
+
+static inline void* _SCOPED_context_calloc(size_t count, size_t size)
+{
+    const scoped_allocator_t* owner = _scoped_allocator_current;
+    void* ptr;
+    size_t total;
+
+    if (__builtin_mul_overflow(count, size, &total) ||
+        total > SIZE_MAX - sizeof(_scoped_context_hdr))
+    {
+        return NULL;
+    }
+
+    if (!owner)
+    {
+        return _SCOPED_context_tag(_SCOPED_BACKEND_CALLOC(1, sizeof(_scoped_context_hdr) + total), NULL, total);
+    }
+
+    ptr = _SCOPED_context_malloc(total);
+    if (ptr)
+    {
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
+
+static inline void _SCOPED_context_free(void* ptr)
+{
+    if (ptr)
+    {
+        _scoped_context_hdr* hdr = (_scoped_context_hdr*)ptr - 1;
+        const scoped_allocator_t* owner = hdr->info.owner;
+
+        if (!owner)
+        {
+            _SCOPED_BACKEND_FREE(hdr);
+        }
+        else if (owner->release)
+        {
+            owner->release(owner->self, hdr, sizeof(_scoped_context_hdr) + hdr->info.size);
+        }
+    }
+}
+
+/* Blocks are resized by the allocator that owns them, not the current one */
+static inline void* _SCOPED_context_realloc(void* ptr, size_t size)
+{
+    _scoped_context_hdr* hdr;
+    const scoped_allocator_t* owner;
+    size_t old_size;
+    void* new_ptr;
+
+    if (!ptr)
+    {
+        return _SCOPED_context_malloc(size);
+    }
+    if (size > SIZE_MAX - sizeof(_scoped_context_hdr))
+    {
+        return NULL;
+    }
+
+    hdr = (_scoped_context_hdr*)ptr - 1;
+    owner = hdr->info.owner;
+    old_size = hdr->info.size;
+
+    if (!owner)
+    {
+        return _SCOPED_context_tag(_SCOPED_BACKEND_REALLOC(hdr, sizeof(_scoped_context_hdr) + size), NULL, size);
+    }
+    if (owner->resize)
+    {
+        return _SCOPED_context_tag(owner->resize(owner->self, hdr, sizeof(_scoped_context_hdr) + old_size,
+                                                 sizeof(_scoped_context_hdr) + size), owner, size);
+    }
+
+    new_ptr = _SCOPED_context_tag(owner->alloc(owner->self, sizeof(_scoped_context_hdr) + size), owner, size);
+    if (!new_ptr)
+    {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    _SCOPED_context_free(ptr);
+    return new_ptr;
+}
+
+/* Route the scoped allocation functions through the context layer */
+#undef _SCOPED_BACKEND_MALLOC
+#undef _SCOPED_BACKEND_CALLOC
+#undef _SCOPED_BACKEND_REALLOC
+#undef _SCOPED_BACKEND_FREE
+#define _SCOPED_BACKEND_MALLOC(size)        _SCOPED_context_malloc(size)
+#define _SCOPED_BACKEND_CALLOC(count, size) _SCOPED_context_calloc((count), (size))
+#define _SCOPED_BACKEND_REALLOC(ptr, size)  _SCOPED_context_realloc((ptr), (size))
+#define _SCOPED_BACKEND_FREE(ptr)           _SCOPED_context_free(ptr)
+
+static inline const scoped_allocator_t* _SCOPED_allocator_push(const scoped_allocator_t* allocator)
+{
+    const scoped_allocator_t* previous = _scoped_allocator_current;
+    _scoped_allocator_current = allocator;
+    return previous;
+}
+
+static inline void _SCOPED_allocator_pop(const scoped_allocator_t** previous)
+{
+    _scoped_allocator_current = *previous;
+}
+
+/**
+ * Make allocator the current allocator of the calling thread until the enclosing scope ends
+ * scoped_malloc, scoped_calloc, scoped_realloc, scoped_buf and friends allocate from it;
+ * every block is freed by the allocator it came from. NULL selects the default allocator
+ * 
+ * Example:
+ *   scoped_allocator_t numa = { numa_alloc, NULL, numa_release, &node0 };
+ *   {
+ *       scoped_allocator_push(&numa);
+ *       scoped_char_p scratch = scoped_malloc(char, 4096); // from numa_alloc
+ *   }
+ */
+#define scoped_allocator_push(allocator)                                                        \
+    _SCOPED(_SCOPED_allocator_pop) const scoped_allocator_t* _SCOPED_UNIQUE(_scoped_allocator_) =   \
+        _SCOPED_allocator_push(allocator)
+
+/* Current allocator of the calling thread, NULL for the default */
+#define scoped_allocator_current()  (_scoped_allocator_current)
+
+#endif
+
+/* Per-call-site allocation statistics, filled in when SCOPED_ENABLE_STATS is defined */
+typedef struct scoped_stats_t
+{
+    const char* file;
+    int line;
+    uint64_t allocs;            // Blocks allocated or resized at this site
+    uint64_t frees;             // Blocks from this site freed or resized away
+    uint64_t bytes;             // Total bytes requested
+    uint64_t live_bytes;        // Bytes currently allocated
+    uint64_t peak_live_bytes;   // High-water mark of live_bytes
+    uint64_t lifetime_ns;       // Sum of the lifetimes of freed blocks
+} scoped_stats_t;
+
+/*
+ * Optional allocation instrumentation
+ *
+ * When SCOPED_ENABLE_STATS is defined, every scoped_malloc, scoped_calloc and scoped_realloc
+ * call site keeps counters that are updated with relaxed atomics, so blocks freed on another
+ * thread or in another translation unit are still accounted to the site that allocated them.
+ * Like the thread cache, this mode prepends a header to every block.
+ *
+ * Each call site is a static record, so in this mode the allocation macros must not be used in
+ * an inline function with external linkage (plain inline in C99 and later), which may not
+ * define modifiable static objects. Use them in static inline or ordinary functions.
+ */
+#ifdef SCOPED_ENABLE_STATS
+
+#include <time.h>
+
+typedef struct _scoped_stats_site
+{
+    scoped_stats_t stats;
+    struct _scoped_stats_site* next;
+    int registered;
+} _scoped_stats_site;
+
+typedef union _scoped_stats_hdr
+{
+    struct
+    {
+        _scoped_stats_site* site;
+        size_t size;
+        uint64_t birth_ns;
+    } info;
+    _scoped_max_align _align;
+} _scoped_stats_hdr;
+
+_scoped_stats_site* _scoped_stats_sites _SCOPED_SHARED = NULL;
+
+static inline uint64_t _SCOPED_now_ns(void)
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+static inline void _SCOPED_stats_sub(uint64_t* counter, uint64_t value)
+{
+    __atomic_fetch_sub(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void _SCOPED_stats_add(uint64_t* counter, uint64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void _SCOPED_stats_track(_scoped_stats_site* site, _scoped_stats_hdr* hdr, size_t size)
+{
+    uint64_t live;
+    uint64_t peak;
+
+    if (!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE) &&
+        !__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL))
+    {
+        site->next = __atomic_load_n(&_scoped_stats_sites, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&_scoped_stats_sites, &site->next, site, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+        }
+    }
+
+    hdr->info.site = site;
+    hdr->info.size = size;
+    hdr->info.birth_ns = _SCOPED_now_ns();
+
+    _SCOPED_stats_add(&site->stats.allocs, 1);
+    _SCOPED_stats_add(&site->stats.bytes, size);
+    live = __atomic_add_fetch(&site->stats.live_bytes, size, __ATOMIC_RELAXED);
+
+    peak = __atomic_load_n(&site->stats.peak_live_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&site->stats.peak_live_bytes, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+static inline void _SCOPED_stats_untrack(_scoped_stats_hdr* hdr)
+{
+    _scoped_stats_site* site = hdr->info.site;
+
+    _SCOPED_stats_add(&site->stats.frees, 1);
+    _SCOPED_stats_sub(&site->stats.live_bytes, hdr->info.size);
+    _SCOPED_stats_add(&site->stats.lifetime_ns, _SCOPED_now_ns() - hdr->info.birth_ns);
+}
+
+static inline void* _SCOPED_stats_malloc(_scoped_stats_site* site, size_t size)
+{
+    _scoped_stats_hdr* hdr;
+
+    if (size > SIZE_MAX - sizeof(_scoped_stats_hdr))
+    {
+        return NULL;
+    }
+
+    hdr = _SCOPED_BACKEND_MALLOC(sizeof(_scoped_stats_hdr) + size);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    _SCOPED_stats_track(site, hdr, size);
+    return hdr + 1;
+}
+
+static inline void* _SCOPED_stats_calloc(_scoped_stats_site* site, size_t count, size_t size)
+{
+    _scoped_stats_hdr* hdr;
+    size_t total;
+
+    if (__builtin_mul_overflow(count, size, &total) ||
+        total > SIZE_MAX - sizeof(_scoped_stats_hdr))
+    {
+        return NULL;
+    }
+
+    hdr = _SCOPED_BACKEND_CALLOC(1, sizeof(_scoped_stats_hdr) + total);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    _SCOPED_stats_track(site, hdr, total);
+    return hdr + 1;
+}
+
+static inline void* _SCOPED_stats_realloc(_scoped_stats_site* site, void* ptr, size_t size)
+{
+    _scoped_stats_hdr* hdr;
+    _scoped_stats_hdr old;
+
+    if (!ptr)
+    {
+        return _SCOPED_stats_malloc(site, size);
+    }
+    if (size > SIZE_MAX - sizeof(_scoped_stats_hdr))
+    {
+        return NULL;
+    }
+
+    old = *((_scoped_stats_hdr*)ptr - 1);
+    hdr = _SCOPED_BACKEND_REALLOC((_scoped_stats_hdr*)ptr - 1, sizeof(_scoped_stats_hdr) + size);
+    if (!hdr)
+    {
+        return NULL;
+    }
+
+    /* The resized block is accounted to the resizing call site */
+    _SCOPED_stats_untrack(&old);
+    _SCOPED_stats_track(site, hdr, size);
+    return hdr + 1;
+}
+
+static inline void _SCOPED_stats_free(void* ptr)
+{
+    if (ptr)
+    {
+        _scoped_stats_hdr* hdr = (_scoped_stats_hdr*)ptr - 1;
+        _SCOPED_stats_untrack(hdr);
+        _SCOPED_BACKEND_FREE(hdr);
+    }
+}
+
+/* Modifiable static storage, hence not valid inside a non-static inline function */
+#define _SCOPED_STATS_SITE(name)    static _scoped_stats_site name = { { __FILE__, __LINE__, 0, 0, 0, 0, 0, 0 }, NULL, 0 }
+
+    #define _SCOPED_UNCHECKED_MALLOC(size)                      \
+        ({                                                      \
+            _SCOPED_STATS_SITE(_site);                          \
+            _SCOPED_stats_malloc(&_site, (size));               \
+        })
+    #define _SCOPED_UNCHECKED_CALLOC(count, size)               \
+        ({                                                      \
+            _SCOPED_STATS_SITE(_site);                          \
+            _SCOPED_stats_calloc(&_site, (count), (size));      \
+        })
+    #define _SCOPED_UNCHECKED_REALLOC(ptr, size)                \
+        ({                                                      \
+            _SCOPED_STATS_SITE(_site);                          \
+            _SCOPED_stats_realloc(&_site, (ptr), (size));       \
+        })
+    #define _SCOPED_UNCHECKED_FREE(ptr) _SCOPED_stats_free(ptr)
+
+static inline void _SCOPED_stats_load(const _scoped_stats_site* site, scoped_stats_t* dst)
+{
+    dst->file = site->stats.file;
+    dst->line = site->stats.line;
+    dst->allocs = __atomic_load_n(&site->stats.allocs, __ATOMIC_RELAXED);
+    dst->frees = __atomic_load_n(&site->stats.frees, __ATOMIC_RELAXED);
+    dst->bytes = __atomic_load_n(&site->stats.bytes, __ATOMIC_RELAXED);
+    dst->live_bytes = __atomic_load_n(&site->stats.live_bytes, __ATOMIC_RELAXED);
+    dst->peak_live_bytes = __atomic_load_n(&site->stats.peak_live_bytes, __ATOMIC_RELAXED);
+    dst->lifetime_ns = __atomic_load_n(&site->stats.lifetime_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * Copy the counters of up to max call sites into out
+ * Returns the number of call sites seen so far, which may exceed max
+ * 
+ * Example:
+ *   scoped_stats_t sites[64];
+ *   size_t n = scoped_stats_snapshot(sites, 64);
+ */
+static inline size_t scoped_stats_snapshot(scoped_stats_t* out, size_t max)
+{
+    const _scoped_stats_site* site = __atomic_load_n(&_scoped_stats_sites, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+
+    for (; site; site = site->next, count++)
+    {
+        if (count < max)
+        {
+            _SCOPED_stats_load(site, &out[count]);
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Print one line of counters per call site
+ * 
+ * Example:
+ *   scoped_stats_dump(stderr);
+ */
+static inline void scoped_stats_dump(FILE* out)
+{
+    const _scoped_stats_site* site = __atomic_load_n(&_scoped_stats_sites, __ATOMIC_ACQUIRE);
+
+    fprintf(out, "%-40s %10s %10s %14s %14s %14s %14s\n",
+            "site", "allocs", "frees", "bytes", "live", "peak", "avg life ns");
+
+    for (; site; site = site->next)
+    {
+        scoped_stats_t stats;
+        char where[40];
+
+        _SCOPED_stats_load(site, &stats);
+        snprintf(where, sizeof(where), "%s:%d", stats.file, stats.line);
+        fprintf(out, "%-40s %10llu %10llu %14llu %14llu %14llu %14llu\n", where,
+                (unsigned long long)stats.allocs, (unsigned long long)stats.frees,
+                (unsigned long long)stats.bytes, (unsigned long long)stats.live_bytes,
+                (unsigned long long)stats.peak_live_bytes,
+                (unsigned long long)(stats.frees ? stats.lifetime_ns / stats.frees : 0));
+    }
+}
+#else
+    #define scoped_stats_snapshot(out, max)     ((void)(out), (void)(max), (size_t)0)
+    #define scoped_stats_dump(out)              ((void)(out))
+
+    #define _SCOPED_UNCHECKED_MALLOC(size)         _SCOPED_BACKEND_MALLOC(size)
+    #define _SCOPED_UNCHECKED_CALLOC(count, size)  _SCOPED_BACKEND_CALLOC((count), (size))
+    #define _SCOPED_UNCHECKED_REALLOC(ptr, size)   _SCOPED_BACKEND_REALLOC((ptr), (size))
+    #define _SCOPED_UNCHECKED_FREE(ptr)            _SCOPED_BACKEND_FREE(ptr)
+#endif
+
+/*
+ * Optional leak, double-free and ownership checking
+ *
+ * When SCOPED_ENABLE_DEBUG is defined, every block from scoped_malloc, scoped_calloc and
+ * scoped_realloc is recorded in a lock-free table keyed by pointer, with its size and call site.
+ * Freeing a block twice is reported and the second free is skipped, SCOPED_RELEASE and
+ * SCOPED_TAKE_OWNERSHIP record where a block left or re-entered scoped ownership, and blocks
+ * still live at exit are reported with those sites.
+ */
+#ifdef SCOPED_ENABLE_DEBUG
+
+/* Allow user to override the number of tracked blocks, a power of two */
+#ifndef SCOPED_DEBUG_SLOTS
+    #define SCOPED_DEBUG_SLOTS          (1u << 20)
+#endif
+
+/* Allow user to override the number of shards, a power of two below SCOPED_DEBUG_SLOTS */
+#ifndef SCOPED_DEBUG_SHARDS
+    #define SCOPED_DEBUG_SHARDS         64
+#endif
+
+/* Allow user to override how many slots a lookup probes before giving up */
+#ifndef SCOPED_DEBUG_PROBE
+    #define SCOPED_DEBUG_PROBE          32
+#endif
+
+/* Allow user to override how many leaked blocks the exit report lists */
+#ifndef SCOPED_DEBUG_REPORT_LIMIT
+    #define SCOPED_DEBUG_REPORT_LIMIT   32
+#endif
+
+#define _SCOPED_DEBUG_SHARD_SLOTS   (SCOPED_DEBUG_SLOTS / SCOPED_DEBUG_SHARDS)
+
+typedef struct _scoped_debug_entry
+{
+    uintptr_t key;              // 0 if never used, the pointer while live, pointer | 1 once freed
+    size_t size;
+    const char* file;           // Allocation site
+    const char* event_file;     // Where the block was last released, taken over or freed
+    int line;
+    int event_line;
+    int released;               // Taken out with SCOPED_RELEASE and not taken back
+} _scoped_debug_entry;
+
+typedef struct _scoped_debug_table
+{
+    _scoped_debug_entry* entries;
+    size_t untracked_frees;     // Frees of pointers the table has never seen
+    size_t dropped;             // Blocks not recorded because their probe window was full
+} _scoped_debug_table;
+
+_scoped_debug_table _scoped_debug _SCOPED_SHARED = { NULL, 0, 0 };
+
+static inline size_t scoped_debug_report(FILE* out);
+
+static inline void _SCOPED_debug_atexit(void)
+{
+    if (scoped_debug_report(NULL))
+    {
+        scoped_debug_report(stderr);
+    }
+}
+
+static inline _scoped_debug_entry* _SCOPED_debug_entries(void)
+{
+    _scoped_debug_entry* entries = __atomic_load_n(&_scoped_debug.entries, __ATOMIC_ACQUIRE);
+    _scoped_debug_entry* expected = NULL;
+
+    if (entries)
+    {
+        return entries;
+    }
+
+    /* Untouched pages of the table cost nothing, calloc maps them lazily */
+    entries = (_scoped_debug_entry*)SCOPED_CALLOC_FUNC(SCOPED_DEBUG_SLOTS, sizeof(_scoped_debug_entry));
+    if (!entries)
+    {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&_scoped_debug.entries, &expected, entries, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        SCOPED_FREE_FUNC(entries);  // Another thread won
+        return expected;
+    }
+    atexit(_SCOPED_debug_atexit);
+    return entries;
+}
+
+/* Pick the shard of key and the first slot of its probe window within the shard */
+static inline _scoped_debug_entry* _SCOPED_debug_shard(_scoped_debug_entry* entries, uintptr_t key, size_t* start)
+{
+    uint64_t hash = (uint64_t)key * UINT64_C(0x9E3779B97F4A7C15);
+    hash ^= hash >> 32;     // Fold the well-mixed high bits down
+    *start = (size_t)(hash / SCOPED_DEBUG_SHARDS) & (_SCOPED_DEBUG_SHARD_SLOTS - 1);
+    return entries + (size_t)(hash & (SCOPED_DEBUG_SHARDS - 1)) * _SCOPED_DEBUG_SHARD_SLOTS;
+}
+
+static inline void _SCOPED_debug_event(_scoped_debug_entry* entry, const char* file, int line)
+{
+    __atomic_store_n(&entry->event_file, file, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->event_line, line, __ATOMIC_RELAXED);
+}
+
+static inline void* _SCOPED_debug_track(void* ptr, size_t size, const char* file, int line)
+{
+    _scoped_debug_entry* entries;
+    _scoped_debug_entry* shard;
+    size_t start;
+    size_t i;
+
+    if (!ptr || !(entries = _SCOPED_debug_entries()))
+    {
+        return ptr;
+    }
+
+    shard = _SCOPED_debug_shard(entries, (uintptr_t)ptr, &start);
+    for (i = 0; i < SCOPED_DEBUG_PROBE; i++)
+    {
+        _scoped_debug_entry* entry = &shard[(start + i) & (_SCOPED_DEBUG_SHARD_SLOTS - 1)];
+        uintptr_t key = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+
+        /* Empty and freed slots are both free to take */
+        if ((key == 0 || (key & 1)) &&
+            __atomic_compare_exchange_n(&entry->key, &key, (uintptr_t)ptr, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&entry->size, size, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->file, file, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->line, line, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->released, 0, __ATOMIC_RELAXED);
+            _SCOPED_debug_event(entry, NULL, 0);
+            return ptr;
+        }
+    }
+
+    __atomic_fetch_add(&_scoped_debug.dropped, 1, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+/* Live entry of addr, or NULL with *freed set to the entry of its last free if there is one */
+static inline _scoped_debug_entry* _SCOPED_debug_find(uintptr_t addr, _scoped_debug_entry** freed)
+{
+    _scoped_debug_entry* entries = __atomic_load_n(&_scoped_debug.entries, __ATOMIC_ACQUIRE);
+    _scoped_debug_entry* shard;
+    size_t start;
+    size_t i;
+
+    *freed = NULL;
+    if (!entries)
+    {
+        return NULL;
+    }
+
+    shard = _SCOPED_debug_shard(entries, addr, &start);
+    for (i = 0; i < SCOPED_DEBUG_PROBE; i++)
+    {
+        _scoped_debug_entry* entry = &shard[(start + i) & (_SCOPED_DEBUG_SHARD_SLOTS - 1)];
+        uintptr_t key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+
+        if (key == addr)
+        {
+            return entry;
+        }
+        if (key == (addr | 1))
+        {
+            *freed = entry;
+        }
+        else if (key == 0)
+        {
+            break;  // Never used past here
+        }
+    }
+    return NULL;
+}
+
+/* A NULL file is a cleanup run at scope exit, which has no call site of its own */
+static inline void _SCOPED_debug_site(const char* what, const char* file, int line)
+{
+    if (file)
+    {
+        fprintf(stderr, "%s %s:%d", what, file, line);
+    }
+    else
+    {
+        fprintf(stderr, "%s scope exit", what);
+    }
+}
+
+static inline void _SCOPED_debug_double_free(uintptr_t addr, _scoped_debug_entry* freed, const char* file, int line)
+{
+    fprintf(stderr, "scoped: double free of %#llx", (unsigned long long)addr);  // Not a pointer, may be stale
+    _SCOPED_debug_site(" at", file, line);
+    fprintf(stderr, ", allocated at %s:%d", __atomic_load_n(&freed->file, __ATOMIC_RELAXED),
+            __atomic_load_n(&freed->line, __ATOMIC_RELAXED));
+    _SCOPED_debug_site(", freed at", __atomic_load_n(&freed->event_file, __ATOMIC_RELAXED),
+                       __atomic_load_n(&freed->event_line, __ATOMIC_RELAXED));
+    fputc('\n', stderr);
+#ifdef SCOPED_DEBUG_ABORT
+    abort();
+#endif
+}
+
+/*
+ * Returns 0 if the block was already freed, so the caller must not free it again
+ * Takes the address as an integer, it may already have been handed back by realloc
+ */
+static inline int _SCOPED_debug_untrack(uintptr_t addr, const char* file, int line)
+{
+    _scoped_debug_entry* freed;
+    _scoped_debug_entry* entry;
+
+    if (!addr)
+    {
+        return 1;
+    }
+
+    entry = _SCOPED_debug_find(addr, &freed);
+    if (entry)
+    {
+        uintptr_t key = addr;
+        if (__atomic_compare_exchange_n(&entry->key, &key, addr | 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            _SCOPED_debug_event(entry, file, line);
+            return 1;
+        }
+        freed = entry;  // Freed by another thread in the meantime
+    }
+
+    if (freed)
+    {
+        _SCOPED_debug_double_free(addr, freed, file, line);
+        return 0;
+    }
+
+    /* Not from the scoped allocation functions, e.g. adopted with SCOPED_TAKE_OWNERSHIP */
+    __atomic_fetch_add(&_scoped_debug.untracked_frees, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* Returns 0 if the block was already freed, so it must not be resized */
+static inline int _SCOPED_debug_check(uintptr_t addr, const char* file, int line)
+{
+    _scoped_debug_entry* freed;
+
+    if (addr && !_SCOPED_debug_find(addr, &freed) && freed)
+    {
+        _SCOPED_debug_double_free(addr, freed, file, line);
+        return 0;
+    }
+    return 1;
+}
+
+static inline void _SCOPED_debug_resized(uintptr_t old_addr, void* new_ptr, size_t size, const char* file, int line)
+{
+    if (new_ptr)
+    {
+        (void)_SCOPED_debug_untrack(old_addr, file, line);
+        _SCOPED_debug_track(new_ptr, size, file, line);
+    }
+}
+
+static inline void _SCOPED_debug_ownership(const void* ptr, int released, const char* file, int line)
+{
+    _scoped_debug_entry* freed;
+    _scoped_debug_entry* entry;
+
+    if (ptr && (entry = _SCOPED_debug_find((uintptr_t)ptr, &freed)))
+    {
+        __atomic_store_n(&entry->released, released, __ATOMIC_RELAXED);
+        _SCOPED_debug_event(entry, file, line);
+    }
+}
+
+#define _SCOPED_DEBUG_RELEASE(ptr)  _SCOPED_debug_ownership((ptr), 1, __FILE__, __LINE__)
+#define _SCOPED_DEBUG_ADOPT(ptr)    _SCOPED_debug_ownership((ptr), 0, __FILE__, __LINE__)
+
+    /*
+     * Call site of a public helper, passed down so the table records the user's line rather
+     * than one in this header. Cleanups run at scope exit pass a NULL file
+     */
+    #define _SCOPED_SITE_PARAMS         , const char* _scoped_file, int _scoped_line
+    #define _SCOPED_SITE_ARGS           , _scoped_file, _scoped_line
+    #define _SCOPED_SITE_HERE           , __FILE__, __LINE__
+    #define _SCOPED_SITE_FORMAT(fmt, first) __attribute__((format(printf, (fmt) + 2, (first) + 2)))
+
+    #define _SCOPED_MALLOC_AT(size, file, line)                                                   \
+        ({                                                                                        \
+            size_t _scoped_debug_size = (size);                                                   \
+            _SCOPED_debug_track(_SCOPED_UNCHECKED_MALLOC(_scoped_debug_size), _scoped_debug_size, \
+                                (file), (line));                                                  \
+        })
+    #define _SCOPED_CALLOC_AT(count, size, file, line)                                             \
+        ({                                                                                         \
+            size_t _scoped_debug_count = (count);                                                  \
+            size_t _scoped_debug_size = (size);                                                    \
+            _SCOPED_debug_track(_SCOPED_UNCHECKED_CALLOC(_scoped_debug_count, _scoped_debug_size), \
+                                _scoped_debug_count * _scoped_debug_size, (file), (line));         \
+        })
+    #define _SCOPED_REALLOC_AT(ptr, size, file, line)                                                 \
+        ({                                                                                            \
+            void* _scoped_debug_old = (ptr);                                                          \
+            size_t _scoped_debug_size = (size);                                                       \
+            uintptr_t _scoped_debug_addr = (uintptr_t)_scoped_debug_old;                              \
+            void* _scoped_debug_new = NULL;                                                           \
+            if (_SCOPED_debug_check(_scoped_debug_addr, (file), (line)))                              \
+            {                                                                                         \
+                _scoped_debug_new = _SCOPED_UNCHECKED_REALLOC(_scoped_debug_old, _scoped_debug_size); \
+                _SCOPED_debug_resized(_scoped_debug_addr, _scoped_debug_new, _scoped_debug_size,      \
+                                      (file), (line));                                                \
+            }                                                                                         \
+            _scoped_debug_new;                                                                        \
+        })
+    #define _SCOPED_FREE_AT(ptr, file, line)                                             \
+        ({                                                                               \
+            void* _scoped_debug_ptr = (ptr);                                             \
+            if (_SCOPED_debug_untrack((uintptr_t)_scoped_debug_ptr, (file), (line)))     \
+            {                                                                            \
+                _SCOPED_UNCHECKED_FREE(_scoped_debug_ptr);                               \
+            }                                                                            \
+        })
+
+    #define _SCOPED_MALLOC(size)                _SCOPED_MALLOC_AT((size), __FILE__, __LINE__)
+    #define _SCOPED_CALLOC(count, size)         _SCOPED_CALLOC_AT((count), (size), __FILE__, __LINE__)
+    #define _SCOPED_REALLOC(ptr, size)          _SCOPED_REALLOC_AT((ptr), (size), __FILE__, __LINE__)
+    #define _SCOPED_FREE(ptr)                   _SCOPED_FREE_AT((ptr), __FILE__, __LINE__)
+
+    /* Inside a function declared with _SCOPED_SITE_PARAMS, or in a cleanup */
+    #define _SCOPED_MALLOC_SITE(size)           _SCOPED_MALLOC_AT((size), _scoped_file, _scoped_line)
+    #define _SCOPED_REALLOC_SITE(ptr, size)     _SCOPED_REALLOC_AT((ptr), (size), _scoped_file, _scoped_line)
+    #define _SCOPED_FREE_SITE(ptr)              _SCOPED_FREE_AT((ptr), _scoped_file, _scoped_line)
+    #define _SCOPED_FREE_SCOPE_EXIT(ptr)        _SCOPED_FREE_AT((ptr), (const char*)NULL, 0)
+
+/**
+ * Print the blocks that are still live, with their allocation site and the site that released
+ * them if they were taken out with SCOPED_RELEASE. Runs at exit when anything is left
+ * Returns the number of live blocks, pass NULL to only count them
+ * 
+ * Example:
+ *   if (scoped_debug_report(NULL) > expected) scoped_debug_report(stderr);
+ */
+static inline size_t scoped_debug_report(FILE* out)
+{
+    _scoped_debug_entry* entries = __atomic_load_n(&_scoped_debug.entries, __ATOMIC_ACQUIRE);
+    size_t live = 0;
+    size_t bytes = 0;
+    size_t i;
+
+    for (i = 0; entries && i < SCOPED_DEBUG_SLOTS; i++)
+    {
+        _scoped_debug_entry* entry = &entries[i];
+        uintptr_t key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+        size_t size;
+
+        if (key == 0 || (key & 1))
+        {
+            continue;
+        }
+
+        size = __atomic_load_n(&entry->size, __ATOMIC_RELAXED);
+        if (out && live < SCOPED_DEBUG_REPORT_LIMIT)
+        {
+            fprintf(out, "scoped: leaked %zu bytes at %p, allocated at %s:%d", size, (void*)key,
+                    __atomic_load_n(&entry->file, __ATOMIC_RELAXED),
+                    __atomic_load_n(&entry->line, __ATOMIC_RELAXED));
+            if (__atomic_load_n(&entry->released, __ATOMIC_RELAXED))
+            {
+                fprintf(out, ", released at %s:%d", __atomic_load_n(&entry->event_file, __ATOMIC_RELAXED),
+                        __atomic_load_n(&entry->event_line, __ATOMIC_RELAXED));
+            }
+            fputc('\n', out);
+        }
+        live++;
+        bytes += size;
+    }
+
+    if (out)
+    {
+        fprintf(out, "scoped: %zu live blocks, %zu bytes", live, bytes);
+        if (__atomic_load_n(&_scoped_debug.dropped, __ATOMIC_RELAXED))
+        {
+            fprintf(out, ", %zu blocks not tracked",
+                    __atomic_load_n(&_scoped_debug.dropped, __ATOMIC_RELAXED));
+        }
+        fputc('\n', out);
+    }
+    return live;
+}
+#else
+    #define scoped_debug_report(out)            ((void)(out), (size_t)0)
+
+    #define _SCOPED_DEBUG_RELEASE(ptr)          ((void)0)
+    #define _SCOPED_DEBUG_ADOPT(ptr)            ((void)0)
+
+    #define _SCOPED_SITE_PARAMS
+    #define _SCOPED_SITE_ARGS
+    #define _SCOPED_SITE_HERE
+    #define _SCOPED_SITE_FORMAT(fmt, first) __attribute__((format(printf, fmt, first)))
+
+    #define _SCOPED_MALLOC(size)                _SCOPED_UNCHECKED_MALLOC(size)
+    #define _SCOPED_CALLOC(count, size)         _SCOPED_UNCHECKED_CALLOC((count), (size))
+    #define _SCOPED_REALLOC(ptr, size)          _SCOPED_UNCHECKED_REALLOC((ptr), (size))
+    #define _SCOPED_FREE(ptr)                   _SCOPED_UNCHECKED_FREE(ptr)
+
+    #define _SCOPED_MALLOC_SITE(size)           _SCOPED_UNCHECKED_MALLOC(size)
+    #define _SCOPED_REALLOC_SITE(ptr, size)     _SCOPED_UNCHECKED_REALLOC((ptr), (size))
+    #define _SCOPED_FREE_SITE(ptr)              _SCOPED_UNCHECKED_FREE(ptr)
+    #define _SCOPED_FREE_SCOPE_EXIT(ptr)        _SCOPED_UNCHECKED_FREE(ptr)
+#endif
+
+static inline void _SCOPED_free(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+	    _SCOPED_FREE_SCOPE_EXIT(*ptr);
+        *ptr = NULL;    // Prevent double-free
+    }
+}
+
+static inline void _SCOPED_fclose(FILE** f)
+{
+    if (*f)
+    {
+        fclose(*f);
+        *f = NULL;  // Prevent double-close
+    }
+}
+
+/* File descriptor support */
+#if SCOPED_HAS_UNISTD
+static inline void _SCOPED_close(int* fd)
+{
+    if (*fd >= 0)
+    {
+        close(*fd);
+        *fd = -1;   // Prevent double-close
+    }
+}
+#endif
+
+/* Core C scalar pointer types */
+#define _SCOPED_VOID_FUNC       _SCOPED_free
+#define _SCOPED_CHAR_FUNC       _SCOPED_free
+#define _SCOPED_SHORT_FUNC      _SCOPED_free
+#define _SCOPED_INT_FUNC        _SCOPED_free
+#define _SCOPED_LONG_FUNC       _SCOPED_free
+#define _SCOPED_FLOAT_FUNC      _SCOPED_free
+#define _SCOPED_DOUBLE_FUNC     _SCOPED_free
+#define _SCOPED_LDOUBLE_FUNC    _SCOPED_free
+
+/* Unsigned scalar pointer types */
+#define _SCOPED_UCHAR_FUNC      _SCOPED_free
+#define _SCOPED_USHORT_FUNC     _SCOPED_free
+#define _SCOPED_UINT_FUNC       _SCOPED_free
+#define _SCOPED_ULONG_FUNC      _SCOPED_free
+#define _SCOPED_ULLONG_FUNC     _SCOPED_free
+
+/* Fixed-width integer pointer types */
+#define _SCOPED_INT8_FUNC       _SCOPED_free
+#define _SCOPED_UINT8_FUNC      _SCOPED_free
+#define _SCOPED_INT16_FUNC      _SCOPED_free
+#define _SCOPED_UINT16_FUNC     _SCOPED_free
+#define _SCOPED_INT32_FUNC      _SCOPED_free
+#define _SCOPED_UINT32_FUNC     _SCOPED_free
+#define _SCOPED_INT64_FUNC      _SCOPED_free
+#define _SCOPED_UINT64_FUNC     _SCOPED_free
+
+/* Pointer-sized integer pointer types */
+#define _SCOPED_INTPTR_FUNC     _SCOPED_free
+#define _SCOPED_UINTPTR_FUNC    _SCOPED_free
+
+/* Other common standard integer types */
+#define _SCOPED_SIZE_FUNC       _SCOPED_free
+#define _SCOPED_SSIZE_FUNC      _SCOPED_free
+#define _SCOPED_PTRDIFF_FUNC    _SCOPED_free
+
+/* Standard library structs */
+#define _SCOPED_FILE_FUNC       _SCOPED_fclose
+
+/* POSIX support */
+#if SCOPED_HAS_UNISTD
+    #define _SCOPED_FD_FUNC     _SCOPED_close
+#endif
+
+#if SCOPED_HAS_SOCKETS
+    #define _SCOPED_SOCKET_FUNC _SCOPED_close
+#endif
+
+/* Type definitions */
+#define scoped_void_p		_SCOPED(_SCOPED_VOID_FUNC)      void*
+#define scoped_char_p		_SCOPED(_SCOPED_CHAR_FUNC)      char*
+#define scoped_short_p		_SCOPED(_SCOPED_SHORT_FUNC)     short*
+#define scoped_int_p		_SCOPED(_SCOPED_INT_FUNC)       int*
+#define scoped_long_p		_SCOPED(_SCOPED_LONG_FUNC)      long*
+#define scoped_float_p		_SCOPED(_SCOPED_FLOAT_FUNC)     float*
+#define scoped_double_p		_SCOPED(_SCOPED_DOUBLE_FUNC)    double*
+#define scoped_ldouble_p    _SCOPED(_SCOPED_LDOUBLE_FUNC)   long double*
+
+#define scoped_uchar_p		_SCOPED(_SCOPED_UCHAR_FUNC)     unsigned char*
+#define scoped_ushort_p		_SCOPED(_SCOPED_USHORT_FUNC)    unsigned short*
+#define scoped_uint_p		_SCOPED(_SCOPED_UINT_FUNC)      unsigned int*
+#define scoped_ulong_p		_SCOPED(_SCOPED_ULONG_FUNC)     unsigned long*
+#define scoped_ullong_p		_SCOPED(_SCOPED_ULLONG_FUNC)    unsigned long long*
+
+#define scoped_int8_p		_SCOPED(_SCOPED_INT8_FUNC)      int8_t*
+#define scoped_uint8_p		_SCOPED(_SCOPED_UINT8_FUNC)     uint8_t*
+#define scoped_int16_p		_SCOPED(_SCOPED_INT16_FUNC)     int16_t*
+#define scoped_uint16_p		_SCOPED(_SCOPED_UINT16_FUNC)    uint16_t*
+#define scoped_int32_p		_SCOPED(_SCOPED_INT32_FUNC)     int32_t*
+#define scoped_uint32_p		_SCOPED(_SCOPED_UINT32_FUNC)    uint32_t*
+#define scoped_int64_p		_SCOPED(_SCOPED_INT64_FUNC)     int64_t*
+#define scoped_uint64_p		_SCOPED(_SCOPED_UINT64_FUNC)    uint64_t*
+
+#define scoped_intptr_p		_SCOPED(_SCOPED_INTPTR_FUNC)    intptr_t*
+#define scoped_uintptr_p	_SCOPED(_SCOPED_UINTPTR_FUNC)   uintptr_t*
+
+#define scoped_size_p		_SCOPED(_SCOPED_SIZE_FUNC)      size_t*
+#define scoped_ssize_p		_SCOPED(_SCOPED_SSIZE_FUNC)     ssize_t*
+#define scoped_ptrdiff_p	_SCOPED(_SCOPED_PTRDIFF_FUNC)   ptrdiff_t*
+
+#define scoped_file_p		_SCOPED(_SCOPED_FILE_FUNC)      FILE*
+
+/* POSIX types */
+#if SCOPED_HAS_UNISTD
+    #define scoped_fd       _SCOPED(_SCOPED_FD_FUNC)        int
+#endif
+
+#if SCOPED_HAS_SOCKETS
+    #define scoped_socket   _SCOPED(_SCOPED_SOCKET_FUNC)    int
+#endif
+
+/* Helper macros */
+
+/* Build identifiers that are unique within a translation unit, for hidden guard variables */
+#define _SCOPED_CONCAT_(a, b)   a##b
+#define _SCOPED_CONCAT(a, b)    _SCOPED_CONCAT_(a, b)
+#define _SCOPED_UNIQUE(prefix)  _SCOPED_CONCAT(prefix, __COUNTER__)
+
+/* Registration macro for user-defined types, also enables scoped_vec(T) and SCOPED_AUTO_TYPE(T) */
+#define SCOPED_REGISTER_CUSTOM_TYPE(T, FUNC)        \
+	static inline void _SCOPED_##T##_CUSTOM(T* p)   \
+	{											    \
+        FUNC(p);                                    \
+	}                                               \
+    static inline void _SCOPED_##T##_AUTO(void* p)  \
+    {                                               \
+        _SCOPED_##T##_CUSTOM((T*)p);                \
+    }                                               \
+    _SCOPED_REGISTER_VEC(T, _SCOPED_##T##_CUSTOM, T, _VEC)
+
+/* Registration macro for user-defined pointer types, also enables scoped_vec_p(T) and SCOPED_AUTO_TYPE_PTR(T) */
+#define SCOPED_REGISTER_CUSTOM_TYPE_PTR(T, FUNC)        \
+	static inline void _SCOPED_##T##_PTR_CUSTOM(T** p)  \
+	{											        \
+        if (*p)                                         \
+        {                                               \
+		    FUNC(*p);                                   \
+            *p = NULL;                                  \
+        }                                               \
+	}                                                   \
+    static inline void _SCOPED_##T##_PTR_AUTO(void* p)  \
+    {                                                   \
+        _SCOPED_##T##_PTR_CUSTOM((T**)p);               \
+    }                                                   \
+    _SCOPED_REGISTER_VEC(T, _SCOPED_##T##_PTR_CUSTOM, T*, _PTR_VEC)
+
+/* Element destruction in one pass over contiguous storage, then a single free */
+#define _SCOPED_REGISTER_VEC(T, CUSTOM, E, SUFFIX)                  \
+    static inline void _SCOPED_##T##SUFFIX##_CLEAR(E* data)         \
+    {                                                               \
+        size_t i;                                                   \
+        size_t len = scoped_buf_len(data);                          \
+        for (i = 0; i < len; i++)                                   \
+        {                                                           \
+            CUSTOM(&data[i]);                                       \
+        }                                                           \
+        if (data)                                                   \
+        {                                                           \
+            _SCOPED_BUF_HDR(data)->info.len = 0;                    \
+        }                                                           \
+    }                                                               \
+    static inline void _SCOPED_##T##SUFFIX##_FREE(E** p)            \
+    {                                                               \
+        _SCOPED_##T##SUFFIX##_CLEAR(*p);                            \
+        _SCOPED_buf_free(p);                                        \
+    }
+
+/* Public macro for scoped user-defined type declaration */
+#define scoped(T)   _SCOPED(_SCOPED_##T##_CUSTOM) T
+
+/* Public macro for scoped user-defined type pointer declaration */
+#define scoped_p(T) _SCOPED(_SCOPED_##T##_PTR_CUSTOM) T*
+
+/**
+ * Scoped vector of registered values, stored contiguously
+ * Grows and is accessed with the scoped_buf_* macros; at scope exit the registered cleanup
+ * runs on every element in order and the storage is freed once
+ * 
+ * Example:
+ *   SCOPED_REGISTER_CUSTOM_TYPE(conn, conn_close)
+ *   scoped_vec(conn) conns = NULL;
+ *   scoped_buf_push(conns, conn_open(addr));
+ */
+#define scoped_vec(T)   _SCOPED(_SCOPED_##T##_VEC_FREE) T*
+
+/**
+ * Scoped vector of registered pointers, each released with its registered cleanup at scope exit
+ * 
+ * Example:
+ *   SCOPED_REGISTER_CUSTOM_TYPE_PTR(session, session_destroy)
+ *   scoped_vec_p(session) sessions = NULL;
+ *   scoped_buf_push(sessions, session_new());
+ */
+#define scoped_vec_p(T) _SCOPED(_SCOPED_##T##_PTR_VEC_FREE) T**
+
+/* Run the registered cleanup on every element and empty the vector, keeping its capacity */
+#define scoped_vec_clear(T, scoped_var)     _SCOPED_##T##_VEC_CLEAR(scoped_var)
+#define scoped_vec_p_clear(T, scoped_var)   _SCOPED_##T##_PTR_VEC_CLEAR(scoped_var)
+
+/**
+ * Destroy the elements and free a vector taken out with SCOPED_RELEASE
+ * 
+ * Example:
+ *   conn* raw = SCOPED_RELEASE(conns);
+ *   scoped_vec_free(conn, raw);
+ */
+#define scoped_vec_free(T, ptr)             \
+    do {                                    \
+        T* _vec = (ptr);                    \
+        _SCOPED_##T##_VEC_FREE(&_vec);      \
+    } while(0)
+
+#define scoped_vec_p_free(T, ptr)           \
+    do {                                    \
+        T** _vec = (ptr);                   \
+        _SCOPED_##T##_PTR_VEC_FREE(&_vec);  \
+    } while(0)
+
+/**
+ * Transfer ownership from one scoped variable to another
+ * Sets source to NULL to prevent double-free
+ * 
+ * Example:
+ *   scoped_int_t a = scoped_malloc(int, 10);
+ *   scoped_int_t b = NULL;
+ *   SCOPED_TRANSFER(b, a); // now b owns the memory, a is NULL
+ */
+#define SCOPED_TRANSFER(dest, src)  \
+    do {                            \
+        (dest) = (src);             \
+        (src) = NULL;               \
+    } while(0)
+
+/**
+ * Transfer ownership from raw pointer to scoped variable
+ * Sets source to NULL to prevent double-free
+ *
+ * With SCOPED_ENABLE_THREAD_CACHE, SCOPED_ENABLE_STATS or
+ * SCOPED_ENABLE_ALLOCATOR_CONTEXT the cleanup reads a header in front of
+ * the block, so raw_ptr must come from scoped_malloc/calloc/realloc.
+ * Plain malloc pointers can only be adopted in the default configuration.
+ * 
+ * Example:
+ *   int* raw = scoped_malloc(int, 10);
+ *   scoped_int_t scoped_arr = NULL;
+ *   SCOPED_TAKE_OWNERSHIP(scoped_arr, raw); // now scoped_arr owns the memory
+ */
+#define SCOPED_TAKE_OWNERSHIP(scoped_var, raw_ptr)  \
+    do {                                            \
+        (scoped_var) = (raw_ptr);                   \
+        _SCOPED_DEBUG_ADOPT(scoped_var);            \
+        (raw_ptr) = NULL;                           \
+    } while(0)
+
+/**
+ * Release ownership from scoped variable to raw pointer
+ * Sets scoped variable to NULL to prevent cleanup
+ * 
+ * Example:
+ *   scoped_int_t scoped_arr = scoped_malloc(int, 10);
+ *   int* raw = SCOPED_RELEASE(scoped_arr); // now you must scoped_free(raw)
+ */
+#define SCOPED_RELEASE(scoped_var)                              \
+    ({                                                          \
+        __typeof__(*(scoped_var))* _released = (scoped_var);    \
+        (scoped_var) = NULL;                                    \
+        _SCOPED_DEBUG_RELEASE(_released);                       \
+        _released;                                              \
+    })
+
+/**
+ * Safe malloc using custom allocator
+ * 
+ * Example:
+ *   scoped_int_t arr = scoped_malloc(int, 10);
+ *   // arr is automatically freed when it goes out of scope
+ */
+#define scoped_malloc(T, count)                             \
+    ({                                                      \
+        T* _ptr = _SCOPED_MALLOC((count) * sizeof(T));      \
+        _ptr;                                               \
+    })
+
+/**
+ * Safe calloc using custom allocator
+ * 
+ * Example:
+ *   scoped_int_t arr = scoped_calloc(int, 10);
+ */
+#define scoped_calloc(T, count)                             \
+    ({                                                      \
+        T* _ptr = _SCOPED_CALLOC((count), sizeof(T));       \
+        _ptr;                                               \
+    })
+
+/**
+ * Safe realloc using custom allocator
+ * 
+ * Note: If realloc fails, the original pointer remains unchanged
+ * 
+ * Example:
+ *   scoped_int_t arr = scoped_malloc(int, 10);
+ *   if (!scoped_realloc(arr, 20))
+ *   {
+ *       // Handle allocation failure - original memory still valid
+ *   }
+ */
+#define scoped_realloc(scoped_var, new_count)                                                               \
+    ({                                                                                                      \
+        __typeof__(*(scoped_var))* _old_ptr = (scoped_var);                                                 \
+        __typeof__(*_old_ptr)* _new_ptr = _SCOPED_REALLOC(_old_ptr, (new_count) * sizeof(*_old_ptr));       \
+        if (_new_ptr)                                                                                       \
+        {                                                                                                   \
+            (scoped_var) = _new_ptr;                                                                        \
+        }                                                                                                   \
+        _new_ptr;                                                                                           \
+    })
+
+/**
+ * Free memory obtained from scoped_malloc, scoped_calloc or scoped_realloc
+ * Use this instead of SCOPED_FREE_FUNC for pointers taken out with SCOPED_RELEASE
+ * 
+ * Example:
+ *   int* raw = SCOPED_RELEASE(arr);
+ *   scoped_free(raw);
+ */
+static inline void _SCOPED_free_at(void* ptr _SCOPED_SITE_PARAMS)
+{
+    _SCOPED_FREE_SITE(ptr);
+}
+
+#define scoped_free(ptr)    _SCOPED_free_at((ptr) _SCOPED_SITE_HERE)
+
+/* Allow user to override the default arena chunk size */
+#ifndef SCOPED_ARENA_CHUNK_SIZE
+    #define SCOPED_ARENA_CHUNK_SIZE (64 * 1024)
+#endif
+
+/* Arena chunk header, the chunk data follows at _SCOPED_ARENA_HDR_SIZE */
+typedef struct _scoped_arena_chunk
+{
+    struct _scoped_arena_chunk* next;   // Previously filled chunk
+    size_t size;                        // Usable bytes in this chunk
+    size_t used;                        // Bytes handed out so far
+} _scoped_arena_chunk;
+
+#define _SCOPED_ARENA_HDR_SIZE  _SCOPED_ALIGN_UP(sizeof(_scoped_arena_chunk), _SCOPED_MAX_ALIGN)
+#define _SCOPED_ARENA_DATA(c)   ((unsigned char*)(c) + _SCOPED_ARENA_HDR_SIZE)
+
+typedef struct scoped_arena_t
+{
+    _scoped_arena_chunk* head;  // Chunk currently being bumped
+    size_t chunk_size;          // Minimum size of newly allocated chunks
+} scoped_arena_t;
+
+static inline void _SCOPED_arena_release_chunks(_scoped_arena_chunk* chunk)
+{
+    while (chunk)
+    {
+        _scoped_arena_chunk* next = chunk->next;
+        SCOPED_FREE_FUNC(chunk);
+        chunk = next;
+    }
+}
+
+static inline void _SCOPED_arena_destroy(scoped_arena_t* arena)
+{
+    _SCOPED_arena_release_chunks(arena->head);
+    arena->head = NULL; // Prevent double-free
+}
+
+/* Slow path: the current chunk is exhausted, start a new one */
+static inline void* _SCOPED_arena_grow(scoped_arena_t* arena, size_t size, size_t align)
+{
+    size_t chunk_size = arena->chunk_size ? arena->chunk_size : SCOPED_ARENA_CHUNK_SIZE;
+    size_t needed = size + align;
+    _scoped_arena_chunk* chunk;
+    uintptr_t start;
+
+    if (needed < size || needed > SIZE_MAX - _SCOPED_ARENA_HDR_SIZE)
+    {
+        return NULL;
+    }
+
+    if (chunk_size < needed)
+    {
+        chunk_size = needed;
+    }
+
+    chunk = SCOPED_MALLOC_FUNC(_SCOPED_ARENA_HDR_SIZE + chunk_size);
+    if (!chunk)
+    {
+        return NULL;
+    }
+
+    chunk->next = arena->head;
+    chunk->size = chunk_size;
+    start = _SCOPED_ALIGN_UP((uintptr_t)_SCOPED_ARENA_DATA(chunk), align);
+    chunk->used = (size_t)(start - (uintptr_t)_SCOPED_ARENA_DATA(chunk)) + size;
+    arena->head = chunk;
+
+    return (void*)start;
+}
+
+/* Bump-allocate count objects of size bytes, NULL if the total overflows */
+static inline void* _SCOPED_arena_alloc(scoped_arena_t* arena, size_t count, size_t elem_size, size_t align)
+{
+    _scoped_arena_chunk* chunk = arena->head;
+    size_t size;
+
+    if (__builtin_mul_overflow(count, elem_size, &size))
+    {
+        return NULL;
+    }
+
+    if (chunk)
+    {
+        uintptr_t base = (uintptr_t)_SCOPED_ARENA_DATA(chunk);
+        uintptr_t start = _SCOPED_ALIGN_UP(base + chunk->used, align);
+
+        if (start - base <= chunk->size && size <= chunk->size - (start - base))
+        {
+            chunk->used = (size_t)(start - base) + size;
+            return (void*)start;
+        }
+    }
+
+    return _SCOPED_arena_grow(arena, size, align);
+}
+
+/**
+ * Scoped arena declaration
+ * All memory handed out by the arena is released at once when it goes out of scope
+ * 
+ * Example:
+ *   scoped_arena arena = scoped_arena_init(0); // 0 selects SCOPED_ARENA_CHUNK_SIZE
+ *   int* values = scoped_arena_alloc(&arena, int, 100);
+ *   // values must not be freed individually, the arena owns it
+ */
+#define scoped_arena    _SCOPED(_SCOPED_arena_destroy) scoped_arena_t
+
+/* Arena initializer, chunk_size is the minimum size of each backing allocation */
+#define scoped_arena_init(chunk_size)   ((scoped_arena_t){ NULL, (chunk_size) })
+
+/**
+ * Bump-allocate count objects of type T from an arena
+ * Returns NULL if count * sizeof(T) overflows, or a new chunk is needed and the allocator fails
+ * 
+ * Example:
+ *   char* line = scoped_arena_alloc(&arena, char, 256);
+ */
+#define scoped_arena_alloc(arena, T, count)                                          \
+    ({                                                                               \
+        T* _ptr = _SCOPED_arena_alloc((arena), (count), sizeof(T), __alignof__(T));  \
+        _ptr;                                                                        \
+    })
+
+/**
+ * Bump-allocate count zero-initialized objects of type T from an arena
+ * 
+ * Example:
+ *   int* counters = scoped_arena_calloc(&arena, int, 16);
+ */
+#define scoped_arena_calloc(arena, T, count)                                         \
+    ({                                                                               \
+        size_t _count = (count);                                                     \
+        T* _ptr = _SCOPED_arena_alloc((arena), _count, sizeof(T), __alignof__(T));   \
+        if (_ptr)                                                                    \
+        {                                                                            \
+            memset(_ptr, 0, _count * sizeof(T));    /* Checked for overflow */       \
+        }                                                                            \
+        _ptr;                                                                        \
+    })
+
+/**
+ * Reset an arena so its memory can be reused
+ * The most recent chunk is kept, every older chunk is released
+ * 
+ * Example:
+ *   for (;;)
+ *   {
+ *       handle_request(&arena);
+ *       scoped_arena_reset(&arena); // O(1) for single-chunk requests
+ *   }
+ */
+static inline void scoped_arena_reset(scoped_arena_t* arena)
+{
+    if (arena->head)
+    {
+        _SCOPED_arena_release_chunks(arena->head->next);
+        arena->head->next = NULL;
+        arena->head->used = 0;
+    }
+}
+
+/**
+ * Registration macro for a fixed-size object pool of type T
+ * Each thread owns capacity slots that are recycled through an intrusive free list,
+ * allocations beyond capacity fall back to SCOPED_MALLOC_FUNC
+ * The slots are allocated on the thread's first scoped_pool_alloc. Every object records the
+ * pool it came from, so it can be returned on any thread: a return on another thread goes to
+ * a lock-free list the owner drains, and a pool whose thread has exited is freed along with
+ * its last outstanding object
+ * 
+ * Note: register T with the same capacity in every translation unit, typically in a shared
+ * header; all of them use the same per-thread pool
+ * 
+ * Example:
+ *   SCOPED_REGISTER_POOL(conn_state, 256)
+ * 
+ *   scoped_pool_p(conn_state) conn = scoped_pool_alloc(conn_state);
+ *   // conn goes back to the pool when it goes out of scope
+ */
+#define SCOPED_REGISTER_POOL(T, capacity)                                               \
+    typedef struct _scoped_pool_##T##_slot                                              \
+    {                                                                                   \
+        union                                                                           \
+        {                                                                               \
+            T obj;      /* First, so an object and its slot share an address */         \
+            struct _scoped_pool_##T##_slot* next;                                       \
+        } u;                                                                            \
+        struct _scoped_pool_##T##_state* owner; /* NULL outside the pool */             \
+    } _scoped_pool_##T##_slot;                                                          \
+                                                                                        \
+    typedef struct _scoped_pool_##T##_state                                             \
+    {                                                                                   \
+        _scoped_thread_exit_node exit;                                                  \
+        _scoped_pool_##T##_slot* free_list;                                             \
+        size_t used;                                                                    \
+        size_t live;    /* Slots checked out, as far as the owner knows */              \
+        _scoped_pool_##T##_slot* remote;    /* Returned on other threads */             \
+        long drained;   /* Remote returns the owner has moved to free_list */           \
+        long remote_refs;   /* Minus remote returns, plus live + drained at exit */     \
+        _scoped_pool_##T##_slot slots[capacity];                                        \
+    } _scoped_pool_##T##_state;                                                         \
+                                                                                        \
+    /* Pool of the calling thread, shared by every translation unit registering T */    \
+    __thread _scoped_pool_##T##_state* _scoped_pool_##T##_self _SCOPED_SHARED = NULL;   \
+                                                                                        \
+    /* Move the slots returned on other threads onto the owner's free list */           \
+    static inline void _SCOPED_##T##_POOL_DRAIN(_scoped_pool_##T##_state* pool)         \
+    {                                                                                   \
+        _scoped_pool_##T##_slot* slot =                                                 \
+            __atomic_exchange_n(&pool->remote, NULL, __ATOMIC_ACQUIRE);                 \
+        long drained = 0;                                                               \
+        while (slot)                                                                    \
+        {                                                                               \
+            _scoped_pool_##T##_slot* next = slot->u.next;                               \
+            slot->u.next = pool->free_list;                                             \
+            pool->free_list = slot;                                                     \
+            drained++;                                                                  \
+            slot = next;                                                                \
+        }                                                                               \
+        pool->live -= (size_t)drained;                                                  \
+        pool->drained += drained;                                                       \
+    }                                                                                   \
+                                                                                        \
+    static inline void _SCOPED_##T##_POOL_EXIT(_scoped_thread_exit_node* node)          \
+    {                                                                                   \
+        _scoped_pool_##T##_state* pool = (_scoped_pool_##T##_state*)node;               \
+        _scoped_pool_##T##_self = NULL;                                                 \
+        _SCOPED_##T##_POOL_DRAIN(pool);                                                 \
+        /* Counts every remote return once, so the last one, on any thread, frees it */ \
+        if (__atomic_add_fetch(&pool->remote_refs, (long)pool->live + pool->drained,    \
+                               __ATOMIC_ACQ_REL) == 0)                                  \
+        {                                                                               \
+            SCOPED_FREE_FUNC(pool);                                                     \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    /* Block outside the pool, freed with SCOPED_FREE_FUNC when returned */             \
+    static inline T* _SCOPED_##T##_POOL_OVERFLOW(void)                                  \
+    {                                                                                   \
+        _scoped_pool_##T##_slot* slot =                                                 \
+            SCOPED_MALLOC_FUNC(sizeof(_scoped_pool_##T##_slot));                        \
+        if (!slot)                                                                      \
+        {                                                                               \
+            return NULL;                                                                \
+        }                                                                               \
+        slot->owner = NULL;                                                             \
+        return &slot->u.obj;                                                            \
+    }                                                                                   \
+                                                                                        \
+    static inline T* _SCOPED_##T##_POOL_ALLOC(void)                                     \
+    {                                                                                   \
+        _scoped_pool_##T##_state* pool = _scoped_pool_##T##_self;                       \
+        if (!pool)                                                                      \
+        {                                                                               \
+            pool = SCOPED_MALLOC_FUNC(sizeof(_scoped_pool_##T##_state));                \
+            if (!pool)                                                                  \
+            {                                                                           \
+                return _SCOPED_##T##_POOL_OVERFLOW();                                   \
+            }                                                                           \
+            pool->free_list = NULL;                                                     \
+            pool->used = 0;                                                             \
+            pool->live = 0;                                                             \
+            pool->remote = NULL;                                                        \
+            pool->drained = 0;                                                          \
+            pool->remote_refs = 0;                                                      \
+            _SCOPED_at_thread_exit(&pool->exit, _SCOPED_##T##_POOL_EXIT);               \
+            _scoped_pool_##T##_self = pool;                                             \
+        }                                                                               \
+        if (!pool->free_list && __atomic_load_n(&pool->remote, __ATOMIC_RELAXED))       \
+        {                                                                               \
+            _SCOPED_##T##_POOL_DRAIN(pool);                                             \
+        }                                                                               \
+        if (pool->free_list)                                                            \
+        {                                                                               \
+            _scoped_pool_##T##_slot* slot = pool->free_list;                            \
+            pool->free_list = slot->u.next;                                             \
+            pool->live++;                                                               \
+            return &slot->u.obj;                                                        \
+        }                                                                               \
+        if (pool->used < (capacity))                                                    \
+        {                                                                               \
+            _scoped_pool_##T##_slot* slot = &pool->slots[pool->used++];                 \
+            slot->owner = pool;                                                         \
+            pool->live++;                                                               \
+            return &slot->u.obj;                                                        \
+        }                                                                               \
+        return _SCOPED_##T##_POOL_OVERFLOW();                                           \
+    }                                                                                   \
+                                                                                        \
+    static inline void _SCOPED_##T##_POOL_FREE(T* p)                                    \
+    {                                                                                   \
+        _scoped_pool_##T##_slot* slot = (_scoped_pool_##T##_slot*)p;                    \
+        _scoped_pool_##T##_state* pool = slot->owner;                                   \
+        if (pool == _scoped_pool_##T##_self && pool)                                    \
+        {                                                                               \
+            slot->u.next = pool->free_list;                                             \
+            pool->free_list = slot;                                                     \
+            pool->live--;                                                               \
+        }                                                                               \
+        else if (pool)                                                                  \
+        {                                                                               \
+            /* Another thread's pool, or one whose thread has exited; pushed first, so  \
+               the pool is not freed until the slot is on its list */                   \
+            slot->u.next = __atomic_load_n(&pool->remote, __ATOMIC_RELAXED);            \
+            while (!__atomic_compare_exchange_n(&pool->remote, &slot->u.next, slot, 1,  \
+                                                __ATOMIC_RELEASE, __ATOMIC_RELAXED))    \
+            {                                                                           \
+            }                                                                           \
+            if (__atomic_sub_fetch(&pool->remote_refs, 1, __ATOMIC_ACQ_REL) == 0)       \
+            {                                                                           \
+                SCOPED_FREE_FUNC(pool); /* Last object of an exited thread's pool */    \
+            }                                                                           \
+        }                                                                               \
+        else                                                                            \
+        {                                                                               \
+            SCOPED_FREE_FUNC(slot);                                                     \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    static inline void _SCOPED_##T##_POOL_RETURN(T** p)                                 \
+    {                                                                                   \
+        if (*p)                                                                         \
+        {                                                                               \
+            _SCOPED_##T##_POOL_FREE(*p);                                                \
+            *p = NULL;  /* Prevent double-return */                                     \
+        }                                                                               \
+    }
+
+/* Public macro for scoped pooled object declaration */
+#define scoped_pool_p(T)    _SCOPED(_SCOPED_##T##_POOL_RETURN) T*
+
+/**
+ * Check out an uninitialized object from the pool registered for T
+ * 
+ * Example:
+ *   scoped_pool_p(parse_node) node = scoped_pool_alloc(parse_node);
+ */
+#define scoped_pool_alloc(T)    _SCOPED_##T##_POOL_ALLOC()
+
+/**
+ * Return an object to the pool registered for T
+ * Only needed for pool objects released from a scoped_pool_p(T) variable
+ * 
+ * Example:
+ *   parse_node* raw = SCOPED_RELEASE(node);
+ *   scoped_pool_free(parse_node, raw);
+ */
+#define scoped_pool_free(T, ptr)    _SCOPED_##T##_POOL_FREE(ptr)
+
+/* Header in front of sized allocations, records the size passed back at free time */
+typedef union _scoped_sized_hdr
+{
+    size_t size;    // Total size of the block, header included
+    _scoped_max_align _align;
+} _scoped_sized_hdr;
+
+#define _SCOPED_SIZED_HDR(ptr)  ((_scoped_sized_hdr*)(ptr) - 1)
+
+static inline void* _SCOPED_sized_alloc(size_t count, size_t size, int zero)
+{
+    _scoped_sized_hdr* hdr;
+    size_t total;
+
+    if (__builtin_mul_overflow(count, size, &total) ||
+        __builtin_add_overflow(total, sizeof(_scoped_sized_hdr), &total))
+    {
+        return NULL;
+    }
+
+    hdr = zero ? SCOPED_CALLOC_FUNC(1, total) : SCOPED_MALLOC_FUNC(total);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->size = total;
+    return hdr + 1;
+}
+
+static inline void* _SCOPED_sized_realloc(void* ptr, size_t count, size_t size)
+{
+    _scoped_sized_hdr* hdr;
+    size_t total;
+
+    if (!ptr)
+    {
+        return _SCOPED_sized_alloc(count, size, 0);
+    }
+
+    if (__builtin_mul_overflow(count, size, &total) ||
+        __builtin_add_overflow(total, sizeof(_scoped_sized_hdr), &total))
+    {
+        return NULL;
+    }
+
+    hdr = SCOPED_REALLOC_FUNC(_SCOPED_SIZED_HDR(ptr), total);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->size = total;
+    return hdr + 1;
+}
+
+static inline void _SCOPED_sized_release(void* ptr)
+{
+    _scoped_sized_hdr* hdr = _SCOPED_SIZED_HDR(ptr);
+    SCOPED_FREE_SIZED_FUNC(hdr, hdr->size);
+}
+
+static inline void _SCOPED_free_sized(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+        _SCOPED_sized_release(*ptr);
+        *ptr = NULL;    // Prevent double-free
+    }
+}
+
+/* Public macro for scoped sized pointer declaration, freed through SCOPED_FREE_SIZED_FUNC */
+#define scoped_sized_p(T)   _SCOPED(_SCOPED_free_sized) T*
+
+/**
+ * Sized malloc, the block size is recorded so the cleanup can pass it to SCOPED_FREE_SIZED_FUNC
+ * 
+ * Example:
+ *   scoped_sized_p(int) arr = scoped_sized_malloc(int, 10);
+ */
+#define scoped_sized_malloc(T, count)                         \
+    ({                                                        \
+        T* _ptr = _SCOPED_sized_alloc((count), sizeof(T), 0); \
+        _ptr;                                                 \
+    })
+
+/**
+ * Sized calloc
+ * 
+ * Example:
+ *   scoped_sized_p(int) arr = scoped_sized_calloc(int, 10);
+ */
+#define scoped_sized_calloc(T, count)                         \
+    ({                                                        \
+        T* _ptr = _SCOPED_sized_alloc((count), sizeof(T), 1); \
+        _ptr;                                                 \
+    })
+
+/**
+ * Sized realloc
+ * 
+ * Note: If realloc fails, the original pointer remains unchanged
+ * 
+ * Example:
+ *   if (!scoped_sized_realloc(arr, 20))
+ *   {
+ *       // Handle allocation failure - original memory still valid
+ *   }
+ */
+#define scoped_sized_realloc(scoped_var, new_count)                                                        \
+    ({                                                                                                     \
+        __typeof__(*(scoped_var))* _old_ptr = (scoped_var);                                                \
+        __typeof__(*_old_ptr)* _new_ptr = _SCOPED_sized_realloc(_old_ptr, (new_count), sizeof(*_old_ptr)); \
+        if (_new_ptr)                                                                                      \
+        {                                                                                                  \
+            (scoped_var) = _new_ptr;                                                                       \
+        }                                                                                                  \
+        _new_ptr;                                                                                          \
+    })
+
+/**
+ * Free a sized allocation taken out of a scoped_sized_p(T) with SCOPED_RELEASE
+ * 
+ * Example:
+ *   int* raw = SCOPED_RELEASE(arr);
+ *   scoped_sized_free(raw);
+ */
+static inline void scoped_sized_free(void* ptr)
+{
+    if (ptr)
+    {
+        _SCOPED_sized_release(ptr);
+    }
+}
+
+/* Allow user to override the growth factor of scoped buffers (NUM / DEN) */
+#ifndef SCOPED_BUF_GROWTH_NUM
+    #define SCOPED_BUF_GROWTH_NUM   2
+#endif
+
+#ifndef SCOPED_BUF_GROWTH_DEN
+    #define SCOPED_BUF_GROWTH_DEN   1
+#endif
+
+/* Allow user to override the capacity of a scoped buffer's first allocation */
+#ifndef SCOPED_BUF_MIN_CAPACITY
+    #define SCOPED_BUF_MIN_CAPACITY 8
+#endif
+
+/* Header in front of scoped buffer elements */
+typedef union _scoped_buf_hdr
+{
+    struct
+    {
+        size_t len; // Elements in use
+        size_t cap; // Elements allocated
+    } info;
+    _scoped_max_align _align;
+} _scoped_buf_hdr;
+
+#define _SCOPED_BUF_HDR(ptr)    ((_scoped_buf_hdr*)(void*)(ptr) - 1)
+
+/* Slow path: grow a buffer geometrically so that it holds at least min_cap elements */
+static inline void* _SCOPED_buf_grow(void* data, size_t elem_size, size_t min_cap _SCOPED_SITE_PARAMS)
+{
+    _scoped_buf_hdr* hdr = data ? _SCOPED_BUF_HDR(data) : NULL;
+    size_t cap = hdr ? hdr->info.cap : 0;
+    size_t new_cap = cap / SCOPED_BUF_GROWTH_DEN * SCOPED_BUF_GROWTH_NUM;
+    size_t bytes;
+
+    if (new_cap <= cap)
+    {
+        new_cap = cap + 1;
+    }
+    if (new_cap < min_cap)
+    {
+        new_cap = min_cap;
+    }
+    if (new_cap < SCOPED_BUF_MIN_CAPACITY)
+    {
+        new_cap = SCOPED_BUF_MIN_CAPACITY;
+    }
+
+    if (__builtin_mul_overflow(new_cap, elem_size, &bytes) ||
+        __builtin_add_overflow(bytes, sizeof(_scoped_buf_hdr), &bytes))
+    {
+        return NULL;
+    }
+
+    hdr = _SCOPED_REALLOC_SITE(hdr, bytes);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    if (!data)
+    {
+        hdr->info.len = 0;
+    }
+    hdr->info.cap = new_cap;
+    return hdr + 1;
+}
+
+static inline void _SCOPED_buf_free(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+        _SCOPED_FREE_SCOPE_EXIT(_SCOPED_BUF_HDR(*ptr));
+        *ptr = NULL;    // Prevent double-free
+    }
+}
+
+/**
+ * Scoped growable buffer declaration
+ * The buffer is a plain T* that starts as NULL, its length and capacity live in front
+ * of the elements and appends grow it geometrically by SCOPED_BUF_GROWTH_NUM / SCOPED_BUF_GROWTH_DEN
+ * 
+ * Example:
+ *   scoped_buf(int) values = NULL;
+ *   for (int i = 0; i < 1000; i++)
+ *   {
+ *       if (!scoped_buf_push(values, i))
+ *       {
+ *           // Handle allocation failure - existing elements still valid
+ *       }
+ *   }
+ */
+#define scoped_buf(T)   _SCOPED(_SCOPED_buf_free) T*
+
+/* Number of elements in a scoped buffer */
+#define scoped_buf_len(scoped_var)  ((scoped_var) ? _SCOPED_BUF_HDR(scoped_var)->info.len : (size_t)0)
+
+/* Number of elements a scoped buffer can hold without growing */
+#define scoped_buf_cap(scoped_var)  ((scoped_var) ? _SCOPED_BUF_HDR(scoped_var)->info.cap : (size_t)0)
+
+/**
+ * Make room for at least min_cap elements
+ * Returns the (possibly moved) buffer, or NULL on failure with the buffer unchanged
+ * 
+ * Example:
+ *   if (!scoped_buf_reserve(values, 4096))
+ *   {
+ *       // Handle allocation failure
+ *   }
+ */
+#define scoped_buf_reserve(scoped_var, min_cap)                                                     \
+    ({                                                                                              \
+        __typeof__(*(scoped_var))* _buf = (scoped_var);                                             \
+        size_t _min_cap = (min_cap);                                                                \
+        if (scoped_buf_cap(_buf) < _min_cap)                                                        \
+        {                                                                                           \
+            _buf = _SCOPED_buf_grow(_buf, sizeof(*_buf), _min_cap _SCOPED_SITE_HERE);               \
+            if (_buf)                                                                               \
+            {                                                                                       \
+                (scoped_var) = _buf;                                                                \
+            }                                                                                       \
+        }                                                                                           \
+        _buf;                                                                                       \
+    })
+
+/**
+ * Append one element, amortized O(1)
+ * Returns nonzero on success, 0 if growing the buffer failed
+ * 
+ * Example:
+ *   scoped_buf_push(values, 42);
+ */
+#define scoped_buf_push(scoped_var, value)                                                          \
+    ({                                                                                              \
+        int _ok = scoped_buf_reserve((scoped_var), scoped_buf_len(scoped_var) + 1) != NULL;         \
+        if (_ok)                                                                                    \
+        {                                                                                           \
+            (scoped_var)[_SCOPED_BUF_HDR(scoped_var)->info.len++] = (value);                        \
+        }                                                                                           \
+        _ok;                                                                                        \
+    })
+
+/**
+ * Append count elements copied from src, amortized O(count)
+ * Returns nonzero on success, 0 if growing the buffer failed or the new length
+ * would overflow SIZE_MAX bytes; the buffer is left unchanged on failure
+ * 
+ * Example:
+ *   scoped_buf(char) out = NULL;
+ *   scoped_buf_append(out, "hello", 5);
+ */
+#define scoped_buf_append(scoped_var, src, count)                                                   \
+    ({                                                                                              \
+        size_t _count = (count);                                                                    \
+        size_t _len = scoped_buf_len(scoped_var);                                                   \
+        int _ok = _count <= SIZE_MAX / sizeof(*(scoped_var)) - _len &&                              \
+                  scoped_buf_reserve((scoped_var), _len + _count) != NULL;                          \
+        if (_ok && _count)                                                                          \
+        {                                                                                           \
+            memcpy((scoped_var) + _len, (src), _count * sizeof(*(scoped_var)));                     \
+            _SCOPED_BUF_HDR(scoped_var)->info.len = _len + _count;                                  \
+        }                                                                                           \
+        _ok;                                                                                        \
+    })
+
+/* Remove and return the last element, the buffer must not be empty */
+#define scoped_buf_pop(scoped_var)  ((scoped_var)[--_SCOPED_BUF_HDR(scoped_var)->info.len])
+
+/* Drop every element but keep the capacity */
+#define scoped_buf_clear(scoped_var)                    \
+    do {                                                \
+        if (scoped_var)                                 \
+        {                                               \
+            _SCOPED_BUF_HDR(scoped_var)->info.len = 0;  \
+        }                                               \
+    } while(0)
+
+/**
+ * Free a buffer taken out of a scoped_buf(T) with SCOPED_RELEASE
+ * 
+ * Example:
+ *   int* raw = SCOPED_RELEASE(values);
+ *   scoped_buf_free(raw);
+ */
+static inline void _SCOPED_buf_free_at(void* data _SCOPED_SITE_PARAMS)
+{
+    if (data)
+    {
+        _SCOPED_FREE_SITE(_SCOPED_BUF_HDR(data));
+    }
+}
+
+#define scoped_buf_free(data)   _SCOPED_buf_free_at((data) _SCOPED_SITE_HERE)
+
+#if defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L
+static inline void* _SCOPED_posix_memalign(size_t size, size_t align)
+{
+    void* ptr;
+
+    if (align < sizeof(void*))
+    {
+        align = sizeof(void*);  // posix_memalign's minimum
+    }
+    return posix_memalign(&ptr, align, size) == 0 ? ptr : NULL;
+}
+#endif
+
+/* Portable fallback: over-allocate and keep the original pointer just below the aligned block */
+static inline void* _SCOPED_fallback_aligned_malloc(size_t size, size_t align)
+{
+    unsigned char* raw;
+    uintptr_t aligned;
+
+    if (align < sizeof(void*))
+    {
+        align = sizeof(void*);
+    }
+    if (size > SIZE_MAX - align - sizeof(void*))
+    {
+        return NULL;
+    }
+
+    raw = SCOPED_MALLOC_FUNC(size + align + sizeof(void*));
+    if (!raw)
+    {
+        return NULL;
+    }
+
+    aligned = _SCOPED_ALIGN_UP((uintptr_t)(raw + sizeof(void*)), align);
+    ((void**)aligned)[-1] = raw;
+    return (void*)aligned;
+}
+
+static inline void _SCOPED_fallback_aligned_free(void* ptr)
+{
+    if (ptr)
+    {
+        SCOPED_FREE_FUNC(((void**)ptr)[-1]);
+    }
+}
+
+static inline void* _SCOPED_aligned_alloc(size_t count, size_t size, size_t align, int zero)
+{
+    size_t total;
+    void* ptr;
+
+    if (align == 0 || (align & (align - 1)) != 0 || __builtin_mul_overflow(count, size, &total))
+    {
+        return NULL;
+    }
+    if (align < _SCOPED_MAX_ALIGN)
+    {
+        align = _SCOPED_MAX_ALIGN;
+    }
+
+    ptr = SCOPED_ALIGNED_MALLOC_FUNC(total ? total : 1, align);
+    if (ptr && zero)
+    {
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
+
+static inline void _SCOPED_aligned_free(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+        SCOPED_ALIGNED_FREE_FUNC(*ptr);
+        *ptr = NULL;    // Prevent double-free
+    }
+}
+
+/* Public macro for scoped aligned pointer declaration, freed through SCOPED_ALIGNED_FREE_FUNC */
+#define scoped_aligned_p(T) _SCOPED(_SCOPED_aligned_free) T*
+
+/**
+ * Aligned malloc, align must be a power of two
+ * 
+ * Example:
+ *   scoped_aligned_p(float) lanes = scoped_aligned_malloc(float, 1024, 64); // AVX-512 friendly
+ *   scoped_aligned_p(counter) slots = scoped_aligned_malloc(counter, n, SCOPED_CACHE_LINE_SIZE);
+ */
+#define scoped_aligned_malloc(T, count, align)                           \
+    ({                                                                   \
+        T* _ptr = _SCOPED_aligned_alloc((count), sizeof(T), (align), 0); \
+        _ptr;                                                            \
+    })
+
+/**
+ * Aligned calloc, align must be a power of two
+ * 
+ * Example:
+ *   scoped_aligned_p(double) acc = scoped_aligned_calloc(double, 512, 32);
+ */
+#define scoped_aligned_calloc(T, count, align)                           \
+    ({                                                                   \
+        T* _ptr = _SCOPED_aligned_alloc((count), sizeof(T), (align), 1); \
+        _ptr;                                                            \
+    })
+
+/**
+ * Free an aligned allocation taken out of a scoped_aligned_p(T) with SCOPED_RELEASE
+ * 
+ * Example:
+ *   float* raw = SCOPED_RELEASE(lanes);
+ *   scoped_aligned_free(raw);
+ */
+static inline void scoped_aligned_free(void* ptr)
+{
+    _SCOPED_aligned_free(&ptr);
+}
+
+/* Heap side of scoped_sbo_buffer, NULL when count * size overflows */
+static inline void* _SCOPED_sbo_alloc(size_t count, size_t size _SCOPED_SITE_PARAMS)
+{
+    size_t total;
+
+    if (__builtin_mul_overflow(count, size, &total))
+    {
+        return NULL;
+    }
+    return _SCOPED_MALLOC_SITE(total);
+}
+
+/**
+ * Small-buffer-optimized scoped allocation
+ * Declares T* name backed by an inline stack array when count <= inline_count,
+ * and by the heap otherwise; only the heap case is freed at scope exit
+ * 
+ * Note: name is NULL if the heap allocation fails or count * sizeof(T) overflows,
+ * and must not be transferred or released
+ * 
+ * Example:
+ *   scoped_sbo_buffer(char, path, 256, strlen(dir) + strlen(file) + 2);
+ *   if (!path) return -1;
+ *   sprintf(path, "%s/%s", dir, file);
+ */
+#define scoped_sbo_buffer(T, name, inline_count, count)                                     \
+    size_t _scoped_sbo_count_##name = (count);                                              \
+    T _scoped_sbo_inline_##name[inline_count];                                              \
+    _SCOPED(_SCOPED_free) void* _scoped_sbo_heap_##name =                                   \
+        _scoped_sbo_count_##name > (inline_count)                                           \
+            ? _SCOPED_sbo_alloc(_scoped_sbo_count_##name, sizeof(T) _SCOPED_SITE_HERE)      \
+            : NULL;                                                                         \
+    T* name = _scoped_sbo_count_##name > (inline_count)                                     \
+        ? (T*)_scoped_sbo_heap_##name                                                       \
+        : _scoped_sbo_inline_##name
+
+/* Memory-mapped file support */
+#if SCOPED_HAS_MMAP && SCOPED_HAS_UNISTD
+
+/* Mapping options for scoped_mmap_fd and scoped_mmap_open */
+#define SCOPED_MMAP_WRITE       0x01    // Map read-write instead of read-only
+#define SCOPED_MMAP_PRIVATE     0x02    // Copy-on-write mapping (MAP_PRIVATE) instead of MAP_SHARED
+#define SCOPED_MMAP_POPULATE    0x04    // Prefault the pages (MAP_POPULATE where available)
+#define SCOPED_MMAP_SEQUENTIAL  0x08    // madvise(MADV_SEQUENTIAL)
+#define SCOPED_MMAP_RANDOM      0x10    // madvise(MADV_RANDOM)
+#define SCOPED_MMAP_WILLNEED    0x20    // madvise(MADV_WILLNEED)
+#define SCOPED_MMAP_HUGEPAGE    0x40    // madvise(MADV_HUGEPAGE) where available
+
+typedef struct scoped_mmap_t
+{
+    void* addr;     // NULL when nothing is mapped
+    size_t length;
+} scoped_mmap_t;
+
+static inline void _SCOPED_munmap(scoped_mmap_t* m)
+{
+    if (m->addr)
+    {
+        munmap(m->addr, m->length);
+        m->addr = NULL; // Prevent double-unmap
+        m->length = 0;
+    }
+}
+
+/**
+ * Apply SCOPED_MMAP_* access advice to an existing mapping
+ * Advice the platform does not support is silently ignored
+ * 
+ * Example:
+ *   scoped_mmap_advise(&map, SCOPED_MMAP_RANDOM);
+ */
+static inline void scoped_mmap_advise(const scoped_mmap_t* m, int flags)
+{
+    if (!m->addr)
+    {
+        return;
+    }
+
+#if defined(MADV_SEQUENTIAL)
+    if (flags & SCOPED_MMAP_SEQUENTIAL)
+    {
+        madvise(m->addr, m->length, MADV_SEQUENTIAL);
+    }
+#endif
+#if defined(MADV_RANDOM)
+    if (flags & SCOPED_MMAP_RANDOM)
+    {
+        madvise(m->addr, m->length, MADV_RANDOM);
+    }
+#endif
+#if defined(MADV_WILLNEED)
+    if (flags & SCOPED_MMAP_WILLNEED)
+    {
+        madvise(m->addr, m->length, MADV_WILLNEED);
+    }
+#endif
+#if defined(MADV_HUGEPAGE)
+    if (flags & SCOPED_MMAP_HUGEPAGE)
+    {
+        madvise(m->addr, m->length, MADV_HUGEPAGE);
+    }
+#endif
+    (void)flags;
+}
+
+/**
+ * Map length bytes of fd starting at offset (a multiple of the page size)
+ * A length of 0 maps everything from offset to the end of the file
+ * Returns a mapping with a NULL addr on failure or when there is nothing to map
+ * 
+ * Example:
+ *   scoped_mmap map = scoped_mmap_fd(fd, 0, 0, SCOPED_MMAP_SEQUENTIAL);
+ */
+static inline scoped_mmap_t scoped_mmap_fd(int fd, off_t offset, size_t length, int flags)
+{
+    scoped_mmap_t m = { NULL, 0 };
+    int prot = PROT_READ;
+    int map_flags = (flags & SCOPED_MMAP_PRIVATE) ? MAP_PRIVATE : MAP_SHARED;
+    void* addr;
+
+    if (length == 0)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= offset)
+        {
+            return m;
+        }
+        length = (size_t)(st.st_size - offset);
+    }
+
+    if (flags & SCOPED_MMAP_WRITE)
+    {
+        prot |= PROT_WRITE;
+    }
+#if defined(MAP_POPULATE)
+    if (flags & SCOPED_MMAP_POPULATE)
+    {
+        map_flags |= MAP_POPULATE;
+    }
+#else
+    if (flags & SCOPED_MMAP_POPULATE)
+    {
+        flags |= SCOPED_MMAP_WILLNEED;  // Closest portable request to prefault
+    }
+#endif
+
+    addr = mmap(NULL, length, prot, map_flags, fd, offset);
+    if (addr == MAP_FAILED)
+    {
+        return m;
+    }
+
+    m.addr = addr;
+    m.length = length;
+    scoped_mmap_advise(&m, flags);
+    return m;
+}
+
+/**
+ * Map a whole file by path, the descriptor is closed once the mapping exists
+ * 
+ * Example:
+ *   scoped_mmap map = scoped_mmap_open("input.bin", SCOPED_MMAP_POPULATE | SCOPED_MMAP_SEQUENTIAL);
+ *   if (!map.addr) return -1;
+ *   checksum(map.addr, map.length);
+ */
+static inline scoped_mmap_t scoped_mmap_open(const char* path, int flags)
+{
+    scoped_mmap_t m = { NULL, 0 };
+    int open_flags = (flags & SCOPED_MMAP_WRITE) && !(flags & SCOPED_MMAP_PRIVATE) ? O_RDWR : O_RDONLY;
+    scoped_fd fd = open(path, open_flags);
+
+    if (fd < 0)
+    {
+        return m;
+    }
+    return scoped_mmap_fd(fd, 0, 0, flags);
+}
+
+/* Public macro for scoped mapping declaration, unmapped at scope exit */
+#define scoped_mmap     _SCOPED(_SCOPED_munmap) scoped_mmap_t
+
+#endif
+
+/* Allow user to override the size from which scoped_large_malloc maps memory directly */
+#ifndef SCOPED_LARGE_THRESHOLD
+    #define SCOPED_LARGE_THRESHOLD  ((size_t)2 * 1024 * 1024)
+#endif
+
+/* Allow user to override the huge page size used to round MAP_HUGETLB mappings */
+#ifndef SCOPED_HUGE_PAGE_SIZE
+    #define SCOPED_HUGE_PAGE_SIZE   ((size_t)2 * 1024 * 1024)
+#endif
+
+/* Options for scoped_large_malloc and scoped_large_calloc */
+#define SCOPED_LARGE_HUGETLB    0x01    // Try explicit huge pages (MAP_HUGETLB) before transparent ones
+#define SCOPED_LARGE_PREFAULT   0x02    // Touch every page up front
+#define SCOPED_LARGE_LOCK       0x04    // mlock the memory, best effort
+
+/**
+ * Header directly in front of large allocations
+ * Mapped blocks keep it at the end of a page of its own, so the block itself starts on a
+ * page boundary (a huge page boundary where the mapping allows) and its size is not padded
+ */
+typedef union _scoped_large_hdr
+{
+    struct
+    {
+        void* base;     // Start of the mapping, one page in front of the block
+        size_t length;  // Bytes mapped from base, 0 for blocks from SCOPED_MALLOC_FUNC
+    } map;
+    _scoped_max_align _align;
+} _scoped_large_hdr;
+
+#define _SCOPED_LARGE_HDR(ptr)  ((_scoped_large_hdr*)(ptr) - 1)
+
+/* Anonymous mappings back large allocations where the platform exposes them */
+#if SCOPED_HAS_MMAP && defined(MAP_ANONYMOUS)
+    #define _SCOPED_MAP_ANONYMOUS   MAP_ANONYMOUS
+#elif SCOPED_HAS_MMAP && defined(MAP_ANON)
+    #define _SCOPED_MAP_ANONYMOUS   MAP_ANON
+#endif
+
+/* Place the header page next to a huge page mapping without clobbering a neighbour */
+#if defined(MAP_FIXED_NOREPLACE)
+    #define _SCOPED_MAP_NOREPLACE   MAP_FIXED_NOREPLACE
+#else
+    #define _SCOPED_MAP_NOREPLACE   0   // Plain hint, the address is checked afterwards
+#endif
+
+#ifdef _SCOPED_MAP_ANONYMOUS
+/**
+ * Map anonymous memory for a large block of size bytes, NULL if the kernel refuses
+ * Only the header page is written; the block's pages are touched only for SCOPED_LARGE_PREFAULT
+ */
+static inline void* _SCOPED_large_map(size_t size, int flags)
+{
+    const int map_flags = MAP_PRIVATE | _SCOPED_MAP_ANONYMOUS;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = _SCOPED_ALIGN_UP(size, page);
+    unsigned char* base = MAP_FAILED;
+    unsigned char* data = MAP_FAILED;
+    _scoped_large_hdr* hdr;
+
+#if defined(MAP_HUGETLB)
+    if (flags & SCOPED_LARGE_HUGETLB)
+    {
+        size_t huge_length = _SCOPED_ALIGN_UP(size, SCOPED_HUGE_PAGE_SIZE);
+        data = mmap(NULL, huge_length, PROT_READ | PROT_WRITE, map_flags | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED)
+        {
+            base = mmap(data - page, page, PROT_READ | PROT_WRITE, map_flags | _SCOPED_MAP_NOREPLACE, -1, 0);
+            if (base == data - page)
+            {
+                length = huge_length;
+            }
+            else
+            {
+                if (base != MAP_FAILED)
+                {
+                    munmap(base, page);
+                }
+                munmap(data, huge_length);  // No room for the header page, use normal pages
+                base = MAP_FAILED;
+            }
+        }
+    }
+#endif
+
+    if (base == MAP_FAILED)
+    {
+        /* Over-map by a huge page so the block can start on a huge page boundary, then trim both ends */
+        size_t span = page + length + SCOPED_HUGE_PAGE_SIZE;
+        unsigned char* span_base = mmap(NULL, span, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+        if (span_base == MAP_FAILED)
+        {
+            return NULL;
+        }
+        data = (unsigned char*)_SCOPED_ALIGN_UP((uintptr_t)span_base + page, SCOPED_HUGE_PAGE_SIZE);
+        base = data - page;
+        if (base > span_base)
+        {
+            munmap(span_base, (size_t)(base - span_base));
+        }
+        if (data + length < span_base + span)
+        {
+            munmap(data + length, (size_t)(span_base + span - (data + length)));
+        }
+#if defined(MADV_HUGEPAGE)
+        madvise(data, length, MADV_HUGEPAGE);   // Transparent huge pages
+#endif
+    }
+
+    if (flags & SCOPED_LARGE_PREFAULT)
+    {
+        size_t offset;
+        for (offset = 0; offset < length; offset += page)
+        {
+            ((volatile unsigned char*)data)[offset] = 0;
+        }
+    }
+
+    if (flags & SCOPED_LARGE_LOCK)
+    {
+        mlock(data, length);
+    }
+
+    hdr = _SCOPED_LARGE_HDR(data);
+    hdr->map.base = base;
+    hdr->map.length = page + length;
+    return data;
+}
+
+/* Bytes of the mapping behind a mapped large block */
+static inline size_t _SCOPED_large_length(void* ptr)
+{
+    _scoped_large_hdr* hdr = _SCOPED_LARGE_HDR(ptr);
+    return hdr->map.length - (size_t)((unsigned char*)ptr - (unsigned char*)hdr->map.base);
+}
+#endif
+
+static inline void* _SCOPED_large_alloc(size_t count, size_t size, int flags, int zero)
+{
+    _scoped_large_hdr* hdr;
+    size_t total;
+
+    if (__builtin_mul_overflow(count, size, &total))
+    {
+        return NULL;
+    }
+
+#ifdef _SCOPED_MAP_ANONYMOUS
+    if (total >= SCOPED_LARGE_THRESHOLD && total <= SIZE_MAX - 2 * SCOPED_HUGE_PAGE_SIZE)
+    {
+        void* ptr = _SCOPED_large_map(total, flags);
+        if (ptr)
+        {
+            return ptr; // Anonymous mappings are already zeroed
+        }
+    }
+#endif
+    (void)flags;
+
+    if (__builtin_add_overflow(total, sizeof(_scoped_large_hdr), &total))
+    {
+        return NULL;
+    }
+    hdr = zero ? SCOPED_CALLOC_FUNC(1, total) : SCOPED_MALLOC_FUNC(total);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->map.length = 0;
+    return hdr + 1;
+}
+
+static inline void _SCOPED_large_release(void* ptr)
+{
+    _scoped_large_hdr* hdr = _SCOPED_LARGE_HDR(ptr);
+
+#ifdef _SCOPED_MAP_ANONYMOUS
+    if (hdr->map.length)
+    {
+        munmap(hdr->map.base, hdr->map.length);
+        return;
+    }
+#endif
+    SCOPED_FREE_FUNC(hdr);
+}
+
+static inline void _SCOPED_large_free(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+        _SCOPED_large_release(*ptr);
+        *ptr = NULL;    // Prevent double-free
+    }
+}
+
+/* Public macro for scoped large pointer declaration */
+#define scoped_large_p(T)   _SCOPED(_SCOPED_large_free) T*
+
+/**
+ * Large allocation, mapped directly with huge page backing from SCOPED_LARGE_THRESHOLD bytes
+ * Smaller requests, and platforms without mmap, use SCOPED_MALLOC_FUNC
+ * 
+ * Example:
+ *   scoped_large_p(float) scratch = scoped_large_malloc(float, 64 << 20, SCOPED_LARGE_PREFAULT);
+ */
+#define scoped_large_malloc(T, count, flags)                            \
+    ({                                                                  \
+        T* _ptr = _SCOPED_large_alloc((count), sizeof(T), (flags), 0);  \
+        _ptr;                                                           \
+    })
+
+/**
+ * Zero-initialized large allocation, mapped memory is not cleared a second time
+ * 
+ * Example:
+ *   scoped_large_p(uint64_t) table = scoped_large_calloc(uint64_t, 1 << 26, SCOPED_LARGE_HUGETLB);
+ */
+#define scoped_large_calloc(T, count, flags)                            \
+    ({                                                                  \
+        T* _ptr = _SCOPED_large_alloc((count), sizeof(T), (flags), 1);  \
+        _ptr;                                                           \
+    })
+
+/**
+ * Free a large allocation taken out of a scoped_large_p(T) with SCOPED_RELEASE
+ * 
+ * Example:
+ *   float* raw = SCOPED_RELEASE(scratch);
+ *   scoped_large_free(raw);
+ */
+static inline void scoped_large_free(void* ptr)
+{
+    _SCOPED_large_free(&ptr);
+}
+
+/* NUMA placement for large allocations */
+#if defined(_SCOPED_MAP_ANONYMOUS) && defined(__linux__) && defined(_DEFAULT_SOURCE)
+    #include <sys/syscall.h>
+    #include <errno.h>
+#endif
+
+/* Allow user to override the highest NUMA node number plus one accepted by scoped_numa_malloc */
+#ifndef SCOPED_NUMA_MAX_NODES
+    #define SCOPED_NUMA_MAX_NODES   1024
+#endif
+
+/* Additional option for scoped_numa_malloc, next to the SCOPED_LARGE_* options */
+#define SCOPED_NUMA_STRICT      0x100   // Fail instead of falling back to other nodes when the node is full
+
+/* Memory policies from <linux/mempolicy.h>, so libnuma is not needed */
+#define _SCOPED_MPOL_PREFERRED  1
+#define _SCOPED_MPOL_BIND       2
+
+#if defined(_SCOPED_MAP_ANONYMOUS) && defined(__linux__) && defined(_DEFAULT_SOURCE) && defined(SYS_mbind)
+    #define SCOPED_HAS_NUMA 1
+#else
+    #define SCOPED_HAS_NUMA 0
+#endif
+
+static inline void* _SCOPED_numa_alloc(size_t count, size_t size, int node, int flags)
+{
+#if SCOPED_HAS_NUMA
+    unsigned long mask[SCOPED_NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+    const size_t bits = 8 * sizeof(unsigned long);
+    unsigned char* data;
+    size_t total;
+    size_t length;
+
+    if (node < 0 || node >= SCOPED_NUMA_MAX_NODES ||
+        __builtin_mul_overflow(count, size, &total) ||
+        total > SIZE_MAX - 2 * SCOPED_HUGE_PAGE_SIZE)
+    {
+        return NULL;
+    }
+
+    /* The header has a page of its own, so none of the block's pages are touched before the policy is set */
+    data = _SCOPED_large_map(total, flags & SCOPED_LARGE_HUGETLB);
+    if (!data)
+    {
+        return NULL;
+    }
+    length = _SCOPED_large_length(data);
+
+    memset(mask, 0, sizeof(mask));
+    mask[(size_t)node / bits] = 1ul << ((size_t)node % bits);
+
+    if (syscall(SYS_mbind, (void*)data, length,
+                (flags & SCOPED_NUMA_STRICT) ? _SCOPED_MPOL_BIND : _SCOPED_MPOL_PREFERRED,
+                mask, (unsigned long)((size_t)node / bits + 1) * bits + 1, 0u) != 0 && errno != ENOSYS)
+    {
+        _SCOPED_large_release(data);    // No such node; ENOSYS means a kernel without NUMA
+        return NULL;
+    }
+
+    if (flags & SCOPED_LARGE_PREFAULT)
+    {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t offset;
+        for (offset = 0; offset < length; offset += page)
+        {
+            ((volatile unsigned char*)data)[offset] = 0;
+        }
+    }
+    if (flags & SCOPED_LARGE_LOCK)
+    {
+        mlock(data, length);
+    }
+    return data;
+#else
+    return node < 0 ? NULL : _SCOPED_large_alloc(count, size, flags & ~SCOPED_NUMA_STRICT, 1);
+#endif
+}
+
+static inline void* _SCOPED_numa_local_alloc(size_t count, size_t size, int flags)
+{
+#ifdef _SCOPED_MAP_ANONYMOUS
+    size_t total;
+
+    if (__builtin_mul_overflow(count, size, &total) ||
+        total > SIZE_MAX - 2 * SCOPED_HUGE_PAGE_SIZE)
+    {
+        return NULL;
+    }
+
+    /* First touch from the calling thread places every page on its node */
+    return _SCOPED_large_map(total, flags | SCOPED_LARGE_PREFAULT);
+#else
+    return _SCOPED_large_alloc(count, size, flags, 1);
+#endif
+}
+
+/* Public macro for scoped NUMA pointer declaration, released like scoped_large_p(T) */
+#define scoped_numa_p(T)    _SCOPED(_SCOPED_large_free) T*
+
+/**
+ * Zero-initialized allocation of count objects of type T placed on NUMA node node
+ * Always mapped directly; SCOPED_LARGE_* options apply and SCOPED_NUMA_STRICT forbids other nodes
+ * Without NUMA support the node is ignored and this behaves like scoped_large_calloc
+ * 
+ * Example:
+ *   scoped_numa_p(double) grid = scoped_numa_malloc(double, 1 << 24, 1, SCOPED_LARGE_PREFAULT);
+ */
+#define scoped_numa_malloc(T, count, node, flags)                               \
+    ({                                                                          \
+        T* _ptr = _SCOPED_numa_alloc((count), sizeof(T), (node), (flags));      \
+        _ptr;                                                                   \
+    })
+
+/**
+ * Zero-initialized allocation placed on the node of the calling thread by touching every page up front
+ * Pin the thread first, pages stay where they were faulted in
+ * 
+ * Example:
+ *   scoped_numa_p(char) scratch = scoped_numa_local_malloc(char, 1 << 20, 0);
+ */
+#define scoped_numa_local_malloc(T, count, flags)                               \
+    ({                                                                          \
+        T* _ptr = _SCOPED_numa_local_alloc((count), sizeof(T), (flags));        \
+        _ptr;                                                                   \
+    })
+
+/**
+ * Free a NUMA allocation taken out of a scoped_numa_p(T) with SCOPED_RELEASE
+ * 
+ * Example:
+ *   double* raw = SCOPED_RELEASE(grid);
+ *   scoped_numa_free(raw);
+ */
+#define scoped_numa_free(ptr)   scoped_large_free(ptr)
+
+/* Allow user to override the number of pointers queued per deferred-free batch */
+#ifndef SCOPED_DEFERRED_BATCH
+    #define SCOPED_DEFERRED_BATCH   64
+#endif
+
+/* A batch of pointers awaiting reclamation */
+typedef struct _scoped_deferred_batch
+{
+    struct _scoped_deferred_batch* next;
+    size_t count;
+    void* blocks[SCOPED_DEFERRED_BATCH];
+} _scoped_deferred_batch;
+
+/* Full batches from every thread, drained by scoped_reclaim */
+_scoped_deferred_batch* _scoped_deferred_queue _SCOPED_SHARED = NULL;
+
+/* Batch being filled by the calling thread, shared by every translation unit */
+__thread _scoped_deferred_batch* _scoped_deferred_local _SCOPED_SHARED = NULL;
+
+/* Publishes the partial batch when the thread exits; fn is NULL until a batch is started */
+__thread _scoped_thread_exit_node _scoped_deferred_exit _SCOPED_SHARED;
+
+static inline void _SCOPED_deferred_publish(_scoped_deferred_batch* batch)
+{
+    batch->next = __atomic_load_n(&_scoped_deferred_queue, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&_scoped_deferred_queue, &batch->next, batch, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+static inline void _SCOPED_deferred_thread_exit(_scoped_thread_exit_node* node)
+{
+    _scoped_deferred_batch* batch = _scoped_deferred_local;
+
+    node->fn = NULL;    // Registered again if a later exit handler queues a pointer
+    if (batch)
+    {
+        _scoped_deferred_local = NULL;
+        _SCOPED_deferred_publish(batch);
+    }
+}
+
+static inline void _SCOPED_deferred_push(void* ptr)
+{
+    _scoped_deferred_batch* batch = _scoped_deferred_local;
+
+    if (!batch)
+    {
+        batch = SCOPED_MALLOC_FUNC(sizeof(_scoped_deferred_batch));
+        if (!batch)
+        {
+            _SCOPED_FREE(ptr);  // Cannot queue, free synchronously
+            return;
+        }
+        batch->count = 0;
+        _scoped_deferred_local = batch;
+        if (!_scoped_deferred_exit.fn)
+        {
+            _SCOPED_at_thread_exit(&_scoped_deferred_exit, _SCOPED_deferred_thread_exit);
+        }
+    }
+
+    batch->blocks[batch->count++] = ptr;
+    if (batch->count == SCOPED_DEFERRED_BATCH)
+    {
+        _scoped_deferred_local = NULL;
+        _SCOPED_deferred_publish(batch);
+    }
+}
+
+static inline void _SCOPED_free_deferred(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+        _SCOPED_deferred_push(*ptr);
+        *ptr = NULL;    // Prevent double-free
+    }
+}
+
+/**
+ * Scoped deferred pointer declaration
+ * At scope exit the pointer is queued instead of freed, and the memory is released
+ * in batches by the next scoped_reclaim call, typically on a background thread
+ * 
+ * Example:
+ *   scoped_deferred_p(char) response = scoped_malloc(char, 1 << 20);
+ */
+#define scoped_deferred_p(T)    _SCOPED(_SCOPED_free_deferred) T*
+
+/**
+ * Hand the calling thread's partially filled batch to the reclaimer
+ * Call before a latency-critical thread goes idle; an exiting thread hands it over itself
+ * 
+ * Example:
+ *   scoped_deferred_flush();
+ */
+static inline void scoped_deferred_flush(void)
+{
+    _scoped_deferred_batch* batch = _scoped_deferred_local;
+
+    if (batch)
+    {
+        _scoped_deferred_local = NULL;
+        _SCOPED_deferred_publish(batch);
+    }
+}
+
+/**
+ * Free every queued pointer, including the calling thread's partial batch
+ * Returns the number of blocks released
+ * 
+ * Example:
+ *   void* reclaimer(void* arg)
+ *   {
+ *       while (running)
+ *       {
+ *           scoped_reclaim();
+ *           usleep(1000);
+ *       }
+ *       return NULL;
+ *   }
+ */
+static inline size_t scoped_reclaim(void)
+{
+    _scoped_deferred_batch* batch;
+    size_t released = 0;
+
+    scoped_deferred_flush();
+    batch = __atomic_exchange_n(&_scoped_deferred_queue, NULL, __ATOMIC_ACQUIRE);
+
+    while (batch)
+    {
+        _scoped_deferred_batch* next = batch->next;
+        size_t i;
+
+        for (i = 0; i < batch->count; i++)
+        {
+            _SCOPED_FREE(batch->blocks[i]);
+        }
+        released += batch->count;
+        SCOPED_FREE_FUNC(batch);
+        batch = next;
+    }
+
+    return released;
+}
+
+/* Allow user to override how many times a contended spinlock spins before yielding */
+#ifndef SCOPED_SPIN_LIMIT
+    #define SCOPED_SPIN_LIMIT   128
+#endif
+
+/* Hint to the CPU that we are busy-waiting */
+#if defined(__x86_64__) || defined(__i386__)
+    #define _SCOPED_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+    #define _SCOPED_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+    #define _SCOPED_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+#if SCOPED_HAS_PTHREAD
+    #define _SCOPED_THREAD_YIELD()  sched_yield()
+#else
+    #define _SCOPED_THREAD_YIELD()  _SCOPED_CPU_RELAX()
+#endif
+
+/* Adaptive spinlock: spins briefly on contention, then yields the CPU */
+typedef struct scoped_spinlock_t
+{
+    int locked;
+} scoped_spinlock_t;
+
+#define SCOPED_SPINLOCK_INIT    { 0 }
+
+/* Slow path: wait for the holder with read-only spinning, then back off to the scheduler */
+static inline void _SCOPED_spinlock_wait(scoped_spinlock_t* lock)
+{
+    for (;;)
+    {
+        int spins;
+
+        for (spins = 0; spins < SCOPED_SPIN_LIMIT; spins++)
+        {
+            if (!__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) &&
+                !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+            {
+                return;
+            }
+            _SCOPED_CPU_RELAX();
+        }
+        _SCOPED_THREAD_YIELD();
+    }
+}
+
+/* Acquire a spinlock, a single atomic exchange when uncontended */
+static inline void scoped_spinlock_acquire(scoped_spinlock_t* lock)
+{
+    if (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+    {
+        _SCOPED_spinlock_wait(lock);
+    }
+}
+
+/* Try to acquire a spinlock without waiting, returns nonzero on success */
+static inline int scoped_spinlock_try_acquire(scoped_spinlock_t* lock)
+{
+    return !__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) &&
+           !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+/* Release a spinlock */
+static inline void scoped_spinlock_release(scoped_spinlock_t* lock)
+{
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline scoped_spinlock_t* _SCOPED_spin_lock(scoped_spinlock_t* lock)
+{
+    scoped_spinlock_acquire(lock);
+    return lock;
+}
+
+static inline void _SCOPED_spin_unlock(scoped_spinlock_t** lock)
+{
+    if (*lock)
+    {
+        scoped_spinlock_release(*lock);
+        *lock = NULL;   // Prevent double-unlock
+    }
+}
+
+/**
+ * Hold a spinlock until the end of the enclosing scope
+ * 
+ * Example:
+ *   static scoped_spinlock_t lock = SCOPED_SPINLOCK_INIT;
+ *   {
+ *       scoped_spin_lock(&lock);
+ *       counter++;
+ *   } // lock released here
+ */
+#define scoped_spin_lock(lock)  \
+    _SCOPED(_SCOPED_spin_unlock) scoped_spinlock_t* _SCOPED_UNIQUE(_scoped_lock_) = _SCOPED_spin_lock(lock)
+
+/* POSIX thread lock guards */
+#if SCOPED_HAS_PTHREAD
+/* An unnamed guard cannot be tested, so running its scope unlocked is never an option */
+static inline void _SCOPED_lock_failed(const char* what, int err)
+{
+    fprintf(stderr, "scoped: %s failed: %s\n", what, strerror(err));
+    abort();
+}
+
+static inline pthread_mutex_t* _SCOPED_mutex_lock_checked(pthread_mutex_t* mutex)
+{
+    return pthread_mutex_lock(mutex) == 0 ? mutex : NULL;
+}
+
+static inline pthread_mutex_t* _SCOPED_mutex_lock(pthread_mutex_t* mutex)
+{
+    int err = pthread_mutex_lock(mutex);
+    if (err)
+    {
+        _SCOPED_lock_failed("pthread_mutex_lock", err);
+    }
+    return mutex;
+}
+
+static inline void _SCOPED_mutex_unlock(pthread_mutex_t** mutex)
+{
+    if (*mutex)
+    {
+        pthread_mutex_unlock(*mutex);
+        *mutex = NULL;  // Prevent double-unlock
+    }
+}
+
+/**
+ * Hold a pthread mutex until the end of the enclosing scope
+ * Aborts if the mutex cannot be locked (EDEADLK, EINVAL...), use scoped_lock_named to handle it
+ * 
+ * Example:
+ *   {
+ *       scoped_lock(&queue->mutex);
+ *       push(queue, item);
+ *   } // mutex unlocked here
+ */
+#define scoped_lock(mutex)      \
+    _SCOPED(_SCOPED_mutex_unlock) pthread_mutex_t* _SCOPED_UNIQUE(_scoped_lock_) = _SCOPED_mutex_lock(mutex)
+
+/**
+ * Hold a pthread mutex until the end of the enclosing scope through a guard named guard
+ * guard is NULL if the mutex could not be locked, and nothing is unlocked at scope exit
+ * 
+ * Example:
+ *   scoped_lock_named(held, &queue->mutex);
+ *   if (!held) return -1;
+ */
+#define scoped_lock_named(guard, mutex)     \
+    _SCOPED(_SCOPED_mutex_unlock) pthread_mutex_t* guard = _SCOPED_mutex_lock_checked(mutex)
+
+/* Read-write locks are a POSIX.1-2001 addition, hidden in strict C modes */
+#if defined(PTHREAD_RWLOCK_INITIALIZER)
+static inline pthread_rwlock_t* _SCOPED_rwlock_rdlock_checked(pthread_rwlock_t* rwlock)
+{
+    return pthread_rwlock_rdlock(rwlock) == 0 ? rwlock : NULL;
+}
+
+static inline pthread_rwlock_t* _SCOPED_rwlock_wrlock_checked(pthread_rwlock_t* rwlock)
+{
+    return pthread_rwlock_wrlock(rwlock) == 0 ? rwlock : NULL;
+}
+
+static inline pthread_rwlock_t* _SCOPED_rwlock_rdlock(pthread_rwlock_t* rwlock)
+{
+    int err = pthread_rwlock_rdlock(rwlock);
+    if (err)
+    {
+        _SCOPED_lock_failed("pthread_rwlock_rdlock", err);
+    }
+    return rwlock;
+}
+
+static inline pthread_rwlock_t* _SCOPED_rwlock_wrlock(pthread_rwlock_t* rwlock)
+{
+    int err = pthread_rwlock_wrlock(rwlock);
+    if (err)
+    {
+        _SCOPED_lock_failed("pthread_rwlock_wrlock", err);
+    }
+    return rwlock;
+}
+
+static inline void _SCOPED_rwlock_unlock(pthread_rwlock_t** rwlock)
+{
+    if (*rwlock)
+    {
+        pthread_rwlock_unlock(*rwlock);
+        *rwlock = NULL; // Prevent double-unlock
+    }
+}
+
+/**
+ * Hold a pthread rwlock for reading until the end of the enclosing scope
+ * Aborts if the lock cannot be taken (EAGAIN on too many readers...), see scoped_rdlock_named
+ * 
+ * Example:
+ *   scoped_rdlock(&table->lock);
+ */
+#define scoped_rdlock(rwlock)   \
+    _SCOPED(_SCOPED_rwlock_unlock) pthread_rwlock_t* _SCOPED_UNIQUE(_scoped_lock_) = _SCOPED_rwlock_rdlock(rwlock)
+
+/**
+ * Hold a pthread rwlock for writing until the end of the enclosing scope
+ * Aborts if the lock cannot be taken (EDEADLK...), see scoped_wrlock_named
+ * 
+ * Example:
+ *   scoped_wrlock(&table->lock);
+ */
+#define scoped_wrlock(rwlock)   \
+    _SCOPED(_SCOPED_rwlock_unlock) pthread_rwlock_t* _SCOPED_UNIQUE(_scoped_lock_) = _SCOPED_rwlock_wrlock(rwlock)
+
+/**
+ * Read or write lock held through a guard named guard, NULL if the lock could not be taken
+ * 
+ * Example:
+ *   scoped_rdlock_named(reading, &table->lock);
+ *   if (!reading) return -1;
+ */
+#define scoped_rdlock_named(guard, rwlock)  \
+    _SCOPED(_SCOPED_rwlock_unlock) pthread_rwlock_t* guard = _SCOPED_rwlock_rdlock_checked(rwlock)
+
+#define scoped_wrlock_named(guard, rwlock)  \
+    _SCOPED(_SCOPED_rwlock_unlock) pthread_rwlock_t* guard = _SCOPED_rwlock_wrlock_checked(rwlock)
+#endif
+#endif
+
+/* Control block in front of shared allocations */
+typedef union _scoped_shared_hdr
+{
+    struct
+    {
+        size_t refs;                // Number of owners
+        void (*destroy)(void*);     // Run by the last owner before the block is freed
+    } info;
+    _scoped_max_align _align;
+} _scoped_shared_hdr;
+
+#define _SCOPED_SHARED_HDR(ptr) ((_scoped_shared_hdr*)(void*)(ptr) - 1)
+
+static inline void* _SCOPED_shared_alloc(size_t count, size_t size, int zero)
+{
+    _scoped_shared_hdr* hdr;
+    size_t total;
+
+    if (__builtin_mul_overflow(count, size, &total) ||
+        __builtin_add_overflow(total, sizeof(_scoped_shared_hdr), &total))
+    {
+        return NULL;
+    }
+
+    hdr = zero ? SCOPED_CALLOC_FUNC(1, total) : SCOPED_MALLOC_FUNC(total);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->info.refs = 1;
+    hdr->info.destroy = NULL;
+    return hdr + 1;
+}
+
+static inline void* _SCOPED_shared_retain(void* ptr)
+{
+    if (ptr)
+    {
+        /* A new owner can only come from an existing one, so no ordering is needed */
+        __atomic_fetch_add(&_SCOPED_SHARED_HDR(ptr)->info.refs, 1, __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+/**
+ * Drop one reference, the last owner destroys and frees the block
+ * Only needed for shared pointers released from a scoped_shared_p(T) variable
+ * 
+ * Example:
+ *   config* raw = SCOPED_RELEASE(cfg);
+ *   scoped_shared_release(raw);
+ */
+static inline void scoped_shared_release(void* ptr)
+{
+    _scoped_shared_hdr* hdr;
+
+    if (!ptr)
+    {
+        return;
+    }
+
+    hdr = _SCOPED_SHARED_HDR(ptr);
+    /* Release our writes, and acquire every other owner's if we are the last one */
+    if (__atomic_fetch_sub(&hdr->info.refs, 1, __ATOMIC_ACQ_REL) == 1)
+    {
+        if (hdr->info.destroy)
+        {
+            hdr->info.destroy(ptr);
+        }
+        SCOPED_FREE_FUNC(hdr);
+    }
+}
+
+static inline void _SCOPED_shared_free(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+        scoped_shared_release(*ptr);
+        *ptr = NULL;    // Prevent double-release
+    }
+}
+
+/* Public macro for scoped shared pointer declaration, drops one reference at scope exit */
+#define scoped_shared_p(T)  _SCOPED(_SCOPED_shared_free) T*
+
+/**
+ * Shared malloc, the reference count lives in the same allocation as the payload
+ * The caller holds the first reference
+ * 
+ * Example:
+ *   scoped_shared_p(config) cfg = scoped_shared_malloc(config, 1);
+ */
+#define scoped_shared_malloc(T, count)                          \
+    ({                                                          \
+        T* _ptr = _SCOPED_shared_alloc((count), sizeof(T), 0);  \
+        _ptr;                                                   \
+    })
+
+/**
+ * Shared calloc
+ * 
+ * Example:
+ *   scoped_shared_p(int) counts = scoped_shared_calloc(int, 256);
+ */
+#define scoped_shared_calloc(T, count)                          \
+    ({                                                          \
+        T* _ptr = _SCOPED_shared_alloc((count), sizeof(T), 1);  \
+        _ptr;                                                   \
+    })
+
+/**
+ * Take another reference, returns ptr so it can initialize a new owner
+ * 
+ * Example:
+ *   scoped_shared_p(config) mine = scoped_shared_retain(global_config);
+ */
+#define scoped_shared_retain(ptr)   ((__typeof__(ptr))_SCOPED_shared_retain(ptr))
+
+/**
+ * Set the function the last owner runs on the payload before it is freed
+ * Call before the pointer is shared with other threads
+ * 
+ * Example:
+ *   scoped_shared_set_destructor(cfg, config_clear);
+ */
+static inline void scoped_shared_set_destructor(void* ptr, void (*destroy)(void*))
+{
+    _SCOPED_SHARED_HDR(ptr)->info.destroy = destroy;
+}
+
+/* Current number of owners, only meaningful as a hint while other threads run */
+static inline size_t scoped_shared_count(const void* ptr)
+{
+    return ptr ? __atomic_load_n(&((const _scoped_shared_hdr*)ptr - 1)->info.refs, __ATOMIC_RELAXED) : 0;
+}
+
+/* Allow user to override the number of threads that can be inside epoch scopes */
+#ifndef SCOPED_EPOCH_MAX_THREADS
+    #define SCOPED_EPOCH_MAX_THREADS    128
+#endif
+
+/* Allow user to override how many retired pointers a thread collects before scanning */
+#ifndef SCOPED_EPOCH_RETIRE_BATCH
+    #define SCOPED_EPOCH_RETIRE_BATCH   64
+#endif
+
+typedef struct _scoped_epoch_retired
+{
+    void* ptr;
+    void (*free_fn)(void*);
+    uint64_t epoch;     // Global epoch when ptr was retired
+} _scoped_epoch_retired;
+
+/* Per-thread epoch record, padded so readers do not share cache lines */
+typedef struct __attribute__((aligned(SCOPED_CACHE_LINE_SIZE))) _scoped_epoch_slot
+{
+    uint64_t local;     // (epoch << 1) | 1 while pinned, 0 otherwise
+    int in_use;         // Claimed by a thread
+    unsigned nesting;   // Owner only: depth of nested guards
+    _scoped_epoch_retired* retired; // Owner only: pointers awaiting two epoch advances
+    size_t retired_count;
+    size_t retired_cap;
+} _scoped_epoch_slot;
+
+typedef struct _scoped_epoch_domain
+{
+    uint64_t epoch;
+    _scoped_epoch_slot slots[SCOPED_EPOCH_MAX_THREADS];
+} _scoped_epoch_domain;
+
+/* One reclamation domain shared by every translation unit */
+_scoped_epoch_domain _scoped_epoch _SCOPED_SHARED;
+
+/* Calling thread's slot, claimed on first use and given back when the thread exits */
+__thread _scoped_epoch_slot* _scoped_epoch_self _SCOPED_SHARED = NULL;
+__thread _scoped_thread_exit_node _scoped_epoch_exit _SCOPED_SHARED;
+
+static inline void scoped_epoch_thread_exit(void);
+
+static inline void _SCOPED_epoch_thread_exit(_scoped_thread_exit_node* node)
+{
+    node->fn = NULL;    // Registered again if a later exit handler enters a guard
+    scoped_epoch_thread_exit();
+}
+
+static inline _scoped_epoch_slot* _SCOPED_epoch_slot(void)
+{
+    _scoped_epoch_slot* slot = _scoped_epoch_self;
+    size_t i;
+
+    if (slot)
+    {
+        return slot;
+    }
+
+    for (i = 0; i < SCOPED_EPOCH_MAX_THREADS; i++)
+    {
+        slot = &_scoped_epoch.slots[i];
+        if (!__atomic_load_n(&slot->in_use, __ATOMIC_RELAXED) &&
+            !__atomic_exchange_n(&slot->in_use, 1, __ATOMIC_ACQUIRE))
+        {
+            _scoped_epoch_self = slot;
+            if (!_scoped_epoch_exit.fn)
+            {
+                _SCOPED_at_thread_exit(&_scoped_epoch_exit, _SCOPED_epoch_thread_exit);
+            }
+            return slot;
+        }
+    }
+
+    return NULL;    // More threads than SCOPED_EPOCH_MAX_THREADS
+}
+
+/* Advance the global epoch if every pinned thread has observed the current one */
+static inline uint64_t _SCOPED_epoch_try_advance(void)
+{
+    uint64_t epoch = __atomic_load_n(&_scoped_epoch.epoch, __ATOMIC_SEQ_CST);
+    size_t i;
+
+    for (i = 0; i < SCOPED_EPOCH_MAX_THREADS; i++)
+    {
+        uint64_t local = __atomic_load_n(&_scoped_epoch.slots[i].local, __ATOMIC_SEQ_CST);
+        if ((local & 1) && (local >> 1) != epoch)
+        {
+            return epoch;   // A reader is still in an older epoch
+        }
+    }
+
+    if (__atomic_compare_exchange_n(&_scoped_epoch.epoch, &epoch, epoch + 1, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        return epoch + 1;
+    }
+    return epoch;   // Someone else advanced, epoch now holds the new value
+}
+
+static inline size_t _SCOPED_epoch_collect(_scoped_epoch_slot* slot)
+{
+    uint64_t epoch = _SCOPED_epoch_try_advance();
+    size_t kept = 0;
+    size_t freed;
+    size_t i;
+
+    for (i = 0; i < slot->retired_count; i++)
+    {
+        _scoped_epoch_retired* entry = &slot->retired[i];
+
+        /* No reader can hold a pointer retired two epochs ago */
+        if (entry->epoch + 2 <= epoch)
+        {
+            entry->free_fn(entry->ptr);
+        }
+        else
+        {
+            slot->retired[kept++] = *entry;
+        }
+    }
+
+    freed = slot->retired_count - kept;
+    slot->retired_count = kept;
+    return freed;
+}
+
+static inline void _SCOPED_epoch_exit(_scoped_epoch_slot** guard)
+{
+    _scoped_epoch_slot* slot = *guard;
+
+    if (slot)
+    {
+        if (--slot->nesting == 0)
+        {
+            __atomic_store_n(&slot->local, 0, __ATOMIC_RELEASE);
+        }
+        *guard = NULL;  // Prevent double-unpin
+    }
+}
+
+/**
+ * Pin the current epoch until the guard goes out of scope
+ * Pointers read from a lock-free structure inside the scope stay valid until it ends
+ * Guards nest; the result is NULL if more than SCOPED_EPOCH_MAX_THREADS threads are registered
+ * 
+ * Example:
+ *   {
+ *       scoped_epoch_guard guard = scoped_epoch_enter();
+ *       node* n = __atomic_load_n(&map->buckets[h], __ATOMIC_ACQUIRE);
+ *       // n cannot be freed before guard goes out of scope
+ *   }
+ */
+static inline _scoped_epoch_slot* scoped_epoch_enter(void)
+{
+    _scoped_epoch_slot* slot = _SCOPED_epoch_slot();
+
+    if (slot && slot->nesting++ == 0)
+    {
+        uint64_t epoch = __atomic_load_n(&_scoped_epoch.epoch, __ATOMIC_RELAXED);
+        (void)__atomic_exchange_n(&slot->local, (epoch << 1) | 1, __ATOMIC_SEQ_CST);  // Publish the pin before reading shared data
+    }
+    return slot;
+}
+
+/* Public macro for epoch guard declaration, unpins at scope exit */
+#define scoped_epoch_guard  _SCOPED(_SCOPED_epoch_exit) _scoped_epoch_slot*
+
+/**
+ * Free ptr with free_fn once no thread can still be reading it
+ * ptr must already be unreachable for new readers
+ * Returns 0 if the pointer could not be queued, in which case the caller still owns it
+ * 
+ * Example:
+ *   node* old = unlink(map, key);
+ *   scoped_retire(old, free);
+ */
+static inline int scoped_retire(void* ptr, void (*free_fn)(void*))
+{
+    _scoped_epoch_slot* slot = _SCOPED_epoch_slot();
+    _scoped_epoch_retired* entry;
+
+    if (!slot)
+    {
+        return 0;
+    }
+
+    if (slot->retired_count == slot->retired_cap)
+    {
+        size_t cap = slot->retired_cap ? slot->retired_cap * 2 : SCOPED_EPOCH_RETIRE_BATCH;
+        _scoped_epoch_retired* grown = SCOPED_REALLOC_FUNC(slot->retired, cap * sizeof(*grown));
+        if (!grown)
+        {
+            return 0;
+        }
+        slot->retired = grown;
+        slot->retired_cap = cap;
+    }
+
+    entry = &slot->retired[slot->retired_count++];
+    entry->ptr = ptr;
+    entry->free_fn = free_fn;
+    entry->epoch = __atomic_load_n(&_scoped_epoch.epoch, __ATOMIC_SEQ_CST);
+
+    if (slot->retired_count >= SCOPED_EPOCH_RETIRE_BATCH)
+    {
+        _SCOPED_epoch_collect(slot);
+    }
+    return 1;
+}
+
+/**
+ * Try to advance the epoch and free the calling thread's reclaimable pointers
+ * Returns the number of pointers freed
+ * 
+ * Example:
+ *   scoped_epoch_collect();
+ */
+static inline size_t scoped_epoch_collect(void)
+{
+    _scoped_epoch_slot* slot = _SCOPED_epoch_slot();
+    return slot ? _SCOPED_epoch_collect(slot) : 0;
+}
+
+/**
+ * Give up the calling thread's epoch slot early, this also happens when the thread exits
+ * Pointers that are not reclaimable yet stay queued and are inherited by the slot's next owner
+ * 
+ * Example:
+ *   scoped_epoch_thread_exit();
+ */
+static inline void scoped_epoch_thread_exit(void)
+{
+    _scoped_epoch_slot* slot = _scoped_epoch_self;
+
+    if (slot && slot->nesting == 0)
+    {
+        _SCOPED_epoch_collect(slot);
+        _scoped_epoch_self = NULL;
+        __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* Allow user to override the number of threads that can hold hazard pointers */
+#ifndef SCOPED_HAZARD_MAX_THREADS
+    #define SCOPED_HAZARD_MAX_THREADS   128
+#endif
+
+/* Allow user to override how many pointers one thread can protect at once */
+#ifndef SCOPED_HAZARD_SLOTS
+    #define SCOPED_HAZARD_SLOTS         4
+#endif
+
+/* Allow user to override how many retired pointers a thread collects before scanning */
+#ifndef SCOPED_HAZARD_RETIRE_BATCH
+    #define SCOPED_HAZARD_RETIRE_BATCH  128
+#endif
+
+typedef struct _scoped_hazard_retired
+{
+    void* ptr;
+    void (*free_fn)(void*);
+} _scoped_hazard_retired;
+
+/* Per-thread hazard record, padded so publishing does not share cache lines */
+typedef struct __attribute__((aligned(SCOPED_CACHE_LINE_SIZE))) _scoped_hazard_record
+{
+    void* slots[SCOPED_HAZARD_SLOTS];   // Published hazards, NULL when free
+    int in_use;                         // Claimed by a thread
+    _scoped_hazard_retired* retired;    // Owner only: pointers waiting for a scan
+    size_t retired_count;
+    size_t retired_cap;
+} _scoped_hazard_record;
+
+typedef struct _scoped_hazard_domain
+{
+    _scoped_hazard_record records[SCOPED_HAZARD_MAX_THREADS];
+} _scoped_hazard_domain;
+
+/* One hazard domain shared by every translation unit */
+_scoped_hazard_domain _scoped_hazard _SCOPED_SHARED;
+
+/* Calling thread's record, claimed on first use and given back when the thread exits */
+__thread _scoped_hazard_record* _scoped_hazard_self _SCOPED_SHARED = NULL;
+__thread _scoped_thread_exit_node _scoped_hazard_exit _SCOPED_SHARED;
+
+static inline void scoped_hazard_thread_exit(void);
+
+static inline void _SCOPED_hazard_thread_exit(_scoped_thread_exit_node* node)
+{
+    node->fn = NULL;    // Registered again if a later exit handler protects a pointer
+    scoped_hazard_thread_exit();
+}
+
+static inline _scoped_hazard_record* _SCOPED_hazard_record(void)
+{
+    _scoped_hazard_record* rec = _scoped_hazard_self;
+    size_t i;
+
+    if (rec)
+    {
+        return rec;
+    }
+
+    for (i = 0; i < SCOPED_HAZARD_MAX_THREADS; i++)
+    {
+        rec = &_scoped_hazard.records[i];
+        if (!__atomic_load_n(&rec->in_use, __ATOMIC_RELAXED) &&
+            !__atomic_exchange_n(&rec->in_use, 1, __ATOMIC_ACQUIRE))
+        {
+            _scoped_hazard_self = rec;
+            if (!_scoped_hazard_exit.fn)
+            {
+                _SCOPED_at_thread_exit(&_scoped_hazard_exit, _SCOPED_hazard_thread_exit);
+            }
+            return rec;
+        }
+    }
+
+    return NULL;    // More threads than SCOPED_HAZARD_MAX_THREADS
+}
+
+static inline void* _SCOPED_hazard_protect(void** src)
+{
+    _scoped_hazard_record* rec = _SCOPED_hazard_record();
+    void** slot = NULL;
+    void* ptr;
+    size_t i;
+
+    if (!rec)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < SCOPED_HAZARD_SLOTS; i++)
+    {
+        if (!rec->slots[i])
+        {
+            slot = &rec->slots[i];
+            break;
+        }
+    }
+
+    if (!slot)
+    {
+        return NULL;    // Every slot of this thread is in use
+    }
+
+    /* Publish, then confirm the source still points there so a scan cannot have missed it */
+    ptr = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+    while (ptr)
+    {
+        void* again;
+
+        __atomic_store_n(slot, ptr, __ATOMIC_SEQ_CST);
+        again = __atomic_load_n(src, __ATOMIC_SEQ_CST);
+        if (again == ptr)
+        {
+            return ptr;
+        }
+        ptr = again;
+    }
+
+    __atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static inline void _SCOPED_hazard_clear(void* p)
+{
+    void** ptr = (void**)p;
+    _scoped_hazard_record* rec = _scoped_hazard_self;
+    size_t i;
+
+    if (*ptr && rec)
+    {
+        for (i = 0; i < SCOPED_HAZARD_SLOTS; i++)
+        {
+            if (rec->slots[i] == *ptr)
+            {
+                __atomic_store_n(&rec->slots[i], NULL, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+        *ptr = NULL;    // Prevent double-clear
+    }
+}
+
+static inline int _SCOPED_hazard_compare(const void* a, const void* b)
+{
+    uintptr_t x = (uintptr_t)*(void* const*)a;
+    uintptr_t y = (uintptr_t)*(void* const*)b;
+    return (x > y) - (x < y);
+}
+
+/* Free every retired pointer that no thread currently publishes */
+static inline size_t _SCOPED_hazard_scan(_scoped_hazard_record* rec)
+{
+    void* hazards[SCOPED_HAZARD_MAX_THREADS * SCOPED_HAZARD_SLOTS];
+    size_t count = 0;
+    size_t kept = 0;
+    size_t freed;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < SCOPED_HAZARD_MAX_THREADS; i++)
+    {
+        for (j = 0; j < SCOPED_HAZARD_SLOTS; j++)
+        {
+            void* hazard = __atomic_load_n(&_scoped_hazard.records[i].slots[j], __ATOMIC_SEQ_CST);
+            if (hazard)
+            {
+                hazards[count++] = hazard;
+            }
+        }
+    }
+
+    qsort(hazards, count, sizeof(void*), _SCOPED_hazard_compare);
+
+    for (i = 0; i < rec->retired_count; i++)
+    {
+        _scoped_hazard_retired* entry = &rec->retired[i];
+
+        if (count && bsearch(&entry->ptr, hazards, count, sizeof(void*), _SCOPED_hazard_compare))
+        {
+            rec->retired[kept++] = *entry;  // Still protected, try again next scan
+        }
+        else
+        {
+            entry->free_fn(entry->ptr);
+        }
+    }
+
+    freed = rec->retired_count - kept;
+    rec->retired_count = kept;
+    return freed;
+}
+
+/* Public macro for hazard-protected pointer declaration, clears its hazard slot at scope exit */
+#define scoped_hazard_p(T)  _SCOPED(_SCOPED_hazard_clear) T*
+
+/**
+ * Load a shared pointer and protect it from reclamation until the scope ends
+ * src is the address of the shared pointer; do not reassign the result
+ * Returns NULL if *src is NULL or all SCOPED_HAZARD_SLOTS of the thread are in use
+ * 
+ * Example:
+ *   scoped_hazard_p(node) n = scoped_hazard_protect(&stack->top);
+ *   if (n) use(n->value);
+ */
+#define scoped_hazard_protect(src)  ((__typeof__(*(src)))_SCOPED_hazard_protect((void**)(src)))
+
+/**
+ * Free ptr with free_fn once no thread publishes it as a hazard
+ * ptr must already be unreachable for new readers
+ * Returns 0 if the pointer could not be queued, in which case the caller still owns it
+ * 
+ * Example:
+ *   node* old = pop(stack);
+ *   scoped_hazard_retire(old, free);
+ */
+static inline int scoped_hazard_retire(void* ptr, void (*free_fn)(void*))
+{
+    _scoped_hazard_record* rec = _SCOPED_hazard_record();
+    _scoped_hazard_retired* entry;
+
+    if (!rec)
+    {
+        return 0;
+    }
+
+    if (rec->retired_count == rec->retired_cap)
+    {
+        size_t cap = rec->retired_cap ? rec->retired_cap * 2 : SCOPED_HAZARD_RETIRE_BATCH;
+        _scoped_hazard_retired* grown = SCOPED_REALLOC_FUNC(rec->retired, cap * sizeof(*grown));
+        if (!grown)
+        {
+            return 0;
+        }
+        rec->retired = grown;
+        rec->retired_cap = cap;
+    }
+
+    entry = &rec->retired[rec->retired_count++];
+    entry->ptr = ptr;
+    entry->free_fn = free_fn;
+
+    if (rec->retired_count >= SCOPED_HAZARD_RETIRE_BATCH)
+    {
+        _SCOPED_hazard_scan(rec);
+    }
+    return 1;
+}
+
+/**
+ * Free the calling thread's retired pointers that are no longer protected
+ * Returns the number of pointers freed
+ * 
+ * Example:
+ *   scoped_hazard_collect();
+ */
+static inline size_t scoped_hazard_collect(void)
+{
+    _scoped_hazard_record* rec = _SCOPED_hazard_record();
+    return rec ? _SCOPED_hazard_scan(rec) : 0;
+}
+
+/**
+ * Give up the calling thread's hazard record early, this also happens when the thread exits
+ * Pointers that are still protected stay queued and are inherited by the record's next owner
+ * 
+ * Example:
+ *   scoped_hazard_thread_exit();
+ */
+static inline void scoped_hazard_thread_exit(void)
+{
+    _scoped_hazard_record* rec = _scoped_hazard_self;
+    size_t i;
+
+    if (rec)
+    {
+        for (i = 0; i < SCOPED_HAZARD_SLOTS; i++)
+        {
+            __atomic_store_n(&rec->slots[i], NULL, __ATOMIC_RELEASE);
+        }
+        _SCOPED_hazard_scan(rec);
+        _scoped_hazard_self = NULL;
+        __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* io_uring rings, registrations and asynchronous close */
+#if SCOPED_HAS_IO_URING
+
+/* Allow user to override the size of the per-thread ring used to close descriptors */
+#ifndef SCOPED_URING_CLOSE_ENTRIES
+    #define SCOPED_URING_CLOSE_ENTRIES  64
+#endif
+
+/* Allow user to override how many closes are queued before they are submitted */
+#ifndef SCOPED_URING_CLOSE_BATCH
+    #define SCOPED_URING_CLOSE_BATCH    1
+#endif
+
+typedef struct scoped_uring_t
+{
+    struct io_uring ring;
+    int ready;      // Nonzero once io_uring_queue_init succeeded
+} scoped_uring_t;
+
+typedef struct scoped_uring_reg_t
+{
+    struct io_uring* ring;  // NULL if registration failed
+} scoped_uring_reg_t;
+
+static inline void _SCOPED_uring_exit(scoped_uring_t* ring)
+{
+    if (ring->ready)
+    {
+        io_uring_queue_exit(&ring->ring);
+        ring->ready = 0;    // Prevent double-exit
+    }
+}
+
+static inline void _SCOPED_uring_unregister_files(scoped_uring_reg_t* reg)
+{
+    if (reg->ring)
+    {
+        io_uring_unregister_files(reg->ring);
+        reg->ring = NULL;   // Prevent double-unregister
+    }
+}
+
+static inline void _SCOPED_uring_unregister_buffers(scoped_uring_reg_t* reg)
+{
+    if (reg->ring)
+    {
+        io_uring_unregister_buffers(reg->ring);
+        reg->ring = NULL;   // Prevent double-unregister
+    }
+}
+
+/* Per-thread ring used by scoped_uring_fd, with the closes queued since the last submit */
+typedef struct _scoped_uring_close_t
+{
+    struct io_uring ring;
+    int state;      // 0 = not set up, 1 = ready, -1 = unavailable
+    unsigned pending;
+    int fds[SCOPED_URING_CLOSE_BATCH];
+    _scoped_thread_exit_node exit;
+} _scoped_uring_close_t;
+
+/* Close ring of the calling thread, shared by every translation unit */
+__thread _scoped_uring_close_t _scoped_uring_close _SCOPED_SHARED;
+
+/*
+ * Submit the queued closes and wait for wait completions. The kernel takes entries in order,
+ * so any it did not take are closed directly and the ring is retired before it can run them
+ */
+static inline void _SCOPED_uring_close_submit(unsigned wait)
+{
+    _scoped_uring_close_t* c = &_scoped_uring_close;
+    int submitted = wait ? io_uring_submit_and_wait(&c->ring, wait) : io_uring_submit(&c->ring);
+    unsigned i = submitted > 0 ? (unsigned)submitted : 0;
+
+    if (i < c->pending)
+    {
+        for (; i < c->pending; i++)
+        {
+            close(c->fds[i]);
+        }
+        io_uring_queue_exit(&c->ring);  // Drops the entries left in the submission queue
+        c->state = -1;
+    }
+    c->pending = 0;
+}
+
+static inline void scoped_uring_close_flush(void);
+
+static inline void _SCOPED_uring_close_thread_exit(_scoped_thread_exit_node* node)
+{
+    node->fn = NULL;    // Registered again if a later exit handler closes through the ring
+    scoped_uring_close_flush();
+}
+
+static inline struct io_uring* _SCOPED_uring_close_ring(void)
+{
+    _scoped_uring_close_t* c = &_scoped_uring_close;
+
+    if (c->state == 0)
+    {
+        c->state = io_uring_queue_init(SCOPED_URING_CLOSE_ENTRIES, &c->ring, 0) == 0 ? 1 : -1;
+        if (c->state > 0 && !c->exit.fn)
+        {
+            _SCOPED_at_thread_exit(&c->exit, _SCOPED_uring_close_thread_exit);
+        }
+    }
+    return c->state > 0 ? &c->ring : NULL;
+}
+
+static inline void _SCOPED_uring_close(int* fd)
+{
+    if (*fd >= 0)
+    {
+        struct io_uring* ring = _SCOPED_uring_close_ring();
+        struct io_uring_sqe* sqe = NULL;
+
+        if (ring)
+        {
+            io_uring_cq_advance(ring, io_uring_cq_ready(ring));    // Completions carry nothing we need
+            sqe = io_uring_get_sqe(ring);
+        }
+
+        if (sqe)
+        {
+            io_uring_prep_close(sqe, *fd);
+            _scoped_uring_close.fds[_scoped_uring_close.pending++] = *fd;
+            if (_scoped_uring_close.pending >= SCOPED_URING_CLOSE_BATCH)
+            {
+                _SCOPED_uring_close_submit(0);
+            }
+        }
+        else
+        {
+            close(*fd); // No ring or submission queue full
+        }
+        *fd = -1;   // Prevent double-close
+    }
+}
+
+/* Public macros for io_uring declarations */
+#define scoped_uring            _SCOPED(_SCOPED_uring_exit) scoped_uring_t
+#define scoped_uring_files      _SCOPED(_SCOPED_uring_unregister_files) scoped_uring_reg_t
+#define scoped_uring_buffers    _SCOPED(_SCOPED_uring_unregister_buffers) scoped_uring_reg_t
+#define scoped_uring_fd         _SCOPED(_SCOPED_uring_close) int
+
+/**
+ * Set up an io_uring instance that is torn down at scope exit
+ * ring.ready is 0 if io_uring_queue_init failed
+ * 
+ * Example:
+ *   scoped_uring ring = scoped_uring_init(256, 0);
+ *   if (!ring.ready) return -1;
+ *   struct io_uring_sqe* sqe = io_uring_get_sqe(&ring.ring);
+ */
+static inline scoped_uring_t scoped_uring_init(unsigned entries, unsigned flags)
+{
+    scoped_uring_t ring;
+    ring.ready = io_uring_queue_init(entries, &ring.ring, flags) == 0;
+    return ring;
+}
+
+/**
+ * Register a file table with a ring, unregistered at scope exit
+ * Declare it after the ring and the descriptors so it is released before them
+ * reg.ring is NULL if registration failed
+ * 
+ * Example:
+ *   scoped_uring_files files = scoped_uring_register_files(&ring, fds, 16);
+ *   io_uring_prep_read(sqe, 3, buf, len, 0); // slot 3 of the table
+ *   io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+ */
+static inline scoped_uring_reg_t scoped_uring_register_files(scoped_uring_t* ring, const int* fds, unsigned count)
+{
+    scoped_uring_reg_t reg = { NULL };
+    if (ring->ready && io_uring_register_files(&ring->ring, fds, count) == 0)
+    {
+        reg.ring = &ring->ring;
+    }
+    return reg;
+}
+
+/**
+ * Register fixed buffers with a ring, unregistered at scope exit
+ * Declare it after the ring and the buffers so it is released before them
+ * reg.ring is NULL if registration failed
+ * 
+ * Example:
+ *   scoped_uring_buffers bufs = scoped_uring_register_buffers(&ring, iov, 4);
+ *   io_uring_prep_read_fixed(sqe, fd, iov[0].iov_base, iov[0].iov_len, 0, 0);
+ */
+static inline scoped_uring_reg_t scoped_uring_register_buffers(scoped_uring_t* ring, const struct iovec* iov, unsigned count)
+{
+    scoped_uring_reg_t reg = { NULL };
+    if (ring->ready && io_uring_register_buffers(&ring->ring, iov, count) == 0)
+    {
+        reg.ring = &ring->ring;
+    }
+    return reg;
+}
+
+/**
+ * Submit queued closes, wait for them and tear down the calling thread's close ring
+ * An exiting thread does this itself; call it to release the ring of a thread that stays alive
+ * 
+ * Example:
+ *   scoped_uring_close_flush();
+ */
+static inline void scoped_uring_close_flush(void)
+{
+    _scoped_uring_close_t* c = &_scoped_uring_close;
+
+    if (c->state > 0)
+    {
+        _SCOPED_uring_close_submit(c->pending);
+    }
+    if (c->state > 0)
+    {
+        io_uring_queue_exit(&c->ring);
+    }
+    c->state = 0;   // Set up again on the next close
+}
+
+#endif
+
+/* Descriptor sets closed together */
+#if SCOPED_HAS_UNISTD
+
+#if defined(__linux__) && defined(_DEFAULT_SOURCE)
+    #include <sys/syscall.h>
+#endif
+
+/* Allow user to override how many descriptors a set holds before it allocates */
+#ifndef SCOPED_FDSET_INLINE
+    #define SCOPED_FDSET_INLINE 32
+#endif
+
+typedef struct scoped_fdset_t
+{
+    int* fds;       // NULL while the inline storage is used
+    size_t count;
+    size_t cap;
+    int inline_fds[SCOPED_FDSET_INLINE];
+} scoped_fdset_t;
+
+/* Initializer for scoped_fdset */
+#define SCOPED_FDSET_INIT   { NULL, 0, 0, { 0 } }
+
+static inline int _SCOPED_fdset_compare(const void* a, const void* b)
+{
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/* Close the descriptors first..last, which are all owned by the set */
+static inline void _SCOPED_close_run(int first, int last)
+{
+#if defined(__linux__) && defined(_DEFAULT_SOURCE) && defined(SYS_close_range)
+    if (first < last && syscall(SYS_close_range, (unsigned)first, (unsigned)last, 0u) == 0)
+    {
+        return;
+    }
+#endif
+
+    for (; first <= last; first++)
+    {
+        close(first);   // No close_range, or a single descriptor
+    }
+}
+
+/**
+ * Close every descriptor in the set and empty it
+ * Descriptors are sorted and each contiguous run is closed with one close_range call where available
+ * 
+ * Example:
+ *   scoped_fdset_close(&conns);
+ */
+static inline void scoped_fdset_close(scoped_fdset_t* set)
+{
+    int* fds = set->fds ? set->fds : set->inline_fds;
+    size_t i = 0;
+
+    qsort(fds, set->count, sizeof(int), _SCOPED_fdset_compare);
+
+    while (i < set->count)
+    {
+        int first = fds[i];
+        int last = first;
+
+        /* Extend the run over consecutive and duplicate descriptors */
+        while (++i < set->count && fds[i] <= last + 1)
+        {
+            last = fds[i];
+        }
+        _SCOPED_close_run(first, last);
+    }
+
+    set->count = 0;
+}
+
+static inline void _SCOPED_fdset_free(scoped_fdset_t* set)
+{
+    scoped_fdset_close(set);
+    if (set->fds)
+    {
+        SCOPED_FREE_FUNC(set->fds);
+        set->fds = NULL;    // Prevent double-free
+    }
+}
+
+/* Public macro for descriptor set declaration, closes every descriptor at scope exit */
+#define scoped_fdset    _SCOPED(_SCOPED_fdset_free) scoped_fdset_t
+
+/**
+ * Hand a descriptor to the set and return it
+ * Negative descriptors are returned unchanged and not added
+ * If the set cannot grow, the descriptor is closed and -1 is returned
+ * 
+ * Example:
+ *   scoped_fdset conns = SCOPED_FDSET_INIT;
+ *   int client = scoped_fdset_add(&conns, accept(listener, NULL, NULL));
+ */
+static inline int scoped_fdset_add(scoped_fdset_t* set, int fd)
+{
+    if (fd < 0)
+    {
+        return fd;
+    }
+
+    if (!set->fds && set->count == SCOPED_FDSET_INLINE)
+    {
+        /* Inline storage is full, move to the heap */
+        int* fds = (int*)SCOPED_MALLOC_FUNC(SCOPED_FDSET_INLINE * 2 * sizeof(int));
+        if (!fds)
+        {
+            close(fd);
+            return -1;
+        }
+        memcpy(fds, set->inline_fds, sizeof(set->inline_fds));
+        set->fds = fds;
+        set->cap = SCOPED_FDSET_INLINE * 2;
+    }
+    else if (set->fds && set->count == set->cap)
+    {
+        int* fds = (int*)SCOPED_REALLOC_FUNC(set->fds, set->cap * 2 * sizeof(int));
+        if (!fds)
+        {
+            close(fd);
+            return -1;
+        }
+        set->fds = fds;
+        set->cap *= 2;
+    }
+
+    (set->fds ? set->fds : set->inline_fds)[set->count++] = fd;
+    return fd;
+}
+
+#endif
+
+/* Zero-copy transfers between descriptors */
+#if SCOPED_HAS_UNISTD
+
+#include <errno.h>
+#if defined(__linux__)
+    #include <sys/sendfile.h>
+#endif
+
+/* Allow user to override the size of the stack buffer used when the kernel cannot copy */
+#ifndef SCOPED_COPY_BUFFER_SIZE
+    #define SCOPED_COPY_BUFFER_SIZE 16384
+#endif
+
+/* Largest transfer Linux performs in one call */
+#define _SCOPED_IO_CHUNK(n) ((n) > 0x7ffff000u ? (size_t)0x7ffff000u : (n))
+
+typedef struct scoped_pipe_t
+{
+    int fds[2];     // Read end, write end; -1 when closed
+} scoped_pipe_t;
+
+static inline void _SCOPED_pipe_close(scoped_pipe_t* p)
+{
+    _SCOPED_close(&p->fds[0]);
+    _SCOPED_close(&p->fds[1]);
+}
+
+/* Public macro for pipe declaration, closes both ends at scope exit */
+#define scoped_pipe _SCOPED(_SCOPED_pipe_close) scoped_pipe_t
+
+/**
+ * Create a pipe whose ends are closed at scope exit
+ * Both descriptors are -1 on failure
+ * 
+ * Example:
+ *   scoped_pipe p = scoped_pipe_open();
+ *   if (p.fds[0] < 0) return -1;
+ */
+static inline scoped_pipe_t scoped_pipe_open(void)
+{
+    scoped_pipe_t p;
+    if (pipe(p.fds) != 0)
+    {
+        p.fds[0] = -1;
+        p.fds[1] = -1;
+    }
+    return p;
+}
+
+/* Write all of buf, retrying on EINTR and short writes */
+static inline int _SCOPED_write_all(int fd, const char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Positioned read, emulated with lseek where pread is not declared */
+static inline ssize_t _SCOPED_pread(int fd, void* buf, size_t len, off_t offset)
+{
+#if defined(_DEFAULT_SOURCE) || (defined(_XOPEN_SOURCE) && _XOPEN_SOURCE >= 500) || \
+    (defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L) || defined(__APPLE__)
+    return pread(fd, buf, len, offset);
+#else
+    return lseek(fd, offset, SEEK_SET) < 0 ? -1 : read(fd, buf, len);
+#endif
+}
+
+/* Copy through a userspace buffer once the kernel paths are unavailable */
+static inline ssize_t _SCOPED_copy_fallback(int out_fd, int in_fd, off_t* offset, size_t count, size_t done)
+{
+    char buf[SCOPED_COPY_BUFFER_SIZE];
+
+    while (done < count)
+    {
+        size_t want = count - done < sizeof(buf) ? count - done : sizeof(buf);
+        ssize_t n = offset ? _SCOPED_pread(in_fd, buf, want, *offset) : read(in_fd, buf, want);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 || (n > 0 && _SCOPED_write_all(out_fd, buf, (size_t)n) != 0))
+        {
+            return done ? (ssize_t)done : -1;
+        }
+        if (n == 0)
+        {
+            break;  // End of input
+        }
+        if (offset)
+        {
+            *offset += n;
+        }
+        done += (size_t)n;
+    }
+
+    return (ssize_t)done;
+}
+
+/* Errors meaning the kernel path does not support this pair of descriptors */
+static inline int _SCOPED_copy_unsupported(int err)
+{
+    return err == ENOSYS || err == EINVAL || err == EXDEV || err == EOPNOTSUPP;
+}
+
+/**
+ * Copy count bytes from in_fd to out_fd with sendfile, without passing through user memory
+ * If offset is not NULL, reading starts there and *offset is advanced instead of the file position
+ * Retries on EINTR and short transfers, and falls back to read/write when sendfile is unavailable
+ * Returns the number of bytes copied, which is less than count at end of input, or -1 on error
+ * 
+ * Example:
+ *   scoped_fd file = open(path, O_RDONLY);
+ *   off_t off = 0;
+ *   scoped_sendfile(client, file, &off, size);
+ */
+static inline ssize_t scoped_sendfile(int out_fd, int in_fd, off_t* offset, size_t count)
+{
+    size_t done = 0;
+
+#if defined(__linux__)
+    while (done < count)
+    {
+        ssize_t n = sendfile(out_fd, in_fd, offset, _SCOPED_IO_CHUNK(count - done));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (_SCOPED_copy_unsupported(errno))
+            {
+                break;  // Finish in userspace
+            }
+            return done ? (ssize_t)done : -1;
+        }
+        if (n == 0)
+        {
+            return (ssize_t)done;   // End of input
+        }
+        done += (size_t)n;
+    }
+#endif
+
+    return _SCOPED_copy_fallback(out_fd, in_fd, offset, count, done);
+}
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+/* Move pending bytes out of a pipe with read/write once out_fd has refused splice */
+static inline ssize_t _SCOPED_pipe_drain(int out_fd, int pipe_fd, size_t pending)
+{
+    char buf[SCOPED_COPY_BUFFER_SIZE];
+    size_t moved = 0;
+
+    while (moved < pending)
+    {
+        size_t want = pending - moved < sizeof(buf) ? pending - moved : sizeof(buf);
+        ssize_t n = read(pipe_fd, buf, want);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0 || _SCOPED_write_all(out_fd, buf, (size_t)n) != 0)
+        {
+            return -1;
+        }
+        moved += (size_t)n;
+    }
+
+    return (ssize_t)moved;
+}
+#endif
+
+/**
+ * Copy count bytes from in_fd to out_fd through pipe buffers with splice
+ * An intermediate pipe is created and closed automatically
+ * offset behaves as in scoped_sendfile; falls back to read/write when splice is unavailable
+ * Returns the number of bytes copied, which is less than count at end of input, or -1 on error
+ * 
+ * Example:
+ *   scoped_splice(upstream, client, NULL, SIZE_MAX); // relay until EOF
+ */
+static inline ssize_t scoped_splice(int out_fd, int in_fd, off_t* offset, size_t count)
+{
+    size_t done = 0;
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    {
+        scoped_pipe p = scoped_pipe_open();
+
+        while (p.fds[0] >= 0 && done < count)
+        {
+            loff_t off = offset ? (loff_t)*offset : 0;
+            ssize_t in = splice(in_fd, offset ? &off : NULL, p.fds[1], NULL,
+                                _SCOPED_IO_CHUNK(count - done), SPLICE_F_MOVE | SPLICE_F_MORE);
+            size_t pending;
+
+            if (in < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (!_SCOPED_copy_unsupported(errno))
+                {
+                    return done ? (ssize_t)done : -1;
+                }
+                break;  // Finish in userspace
+            }
+            if (in == 0)
+            {
+                return (ssize_t)done;   // End of input
+            }
+            if (offset)
+            {
+                *offset = (off_t)off;
+            }
+
+            /* Drain what entered the pipe before reading more */
+            pending = (size_t)in;
+            while (pending > 0)
+            {
+                ssize_t out = splice(p.fds[0], NULL, out_fd, NULL, pending, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (out < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (!_SCOPED_copy_unsupported(errno))
+                    {
+                        return done ? (ssize_t)done : -1;   // Bytes left in the pipe are lost with it
+                    }
+                    out = _SCOPED_pipe_drain(out_fd, p.fds[0], pending);
+                    if (out < 0)
+                    {
+                        return done ? (ssize_t)done : -1;
+                    }
+                    done += (size_t)out;
+                    return _SCOPED_copy_fallback(out_fd, in_fd, offset, count, done);
+                }
+                pending -= (size_t)out;
+                done += (size_t)out;
+            }
+        }
+    }
+#endif
+
+    return _SCOPED_copy_fallback(out_fd, in_fd, offset, count, done);
+}
+
+/**
+ * Copy count bytes between files with copy_file_range, letting the filesystem share or clone extents
+ * Writing happens at out_fd's file position; offset behaves as in scoped_sendfile
+ * Falls back to read/write across filesystems or when copy_file_range is unavailable
+ * Returns the number of bytes copied, which is less than count at end of input, or -1 on error
+ * 
+ * Example:
+ *   scoped_fd src = open("a.bin", O_RDONLY);
+ *   scoped_fd dst = open("b.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+ *   scoped_copy_file_range(dst, src, NULL, size);
+ */
+static inline ssize_t scoped_copy_file_range(int out_fd, int in_fd, off_t* offset, size_t count)
+{
+    size_t done = 0;
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    while (done < count)
+    {
+        loff_t off = offset ? (loff_t)*offset : 0;
+        ssize_t n = copy_file_range(in_fd, offset ? &off : NULL, out_fd, NULL, _SCOPED_IO_CHUNK(count - done), 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (_SCOPED_copy_unsupported(errno))
+            {
+                break;  // Finish in userspace
+            }
+            return done ? (ssize_t)done : -1;
+        }
+        if (n == 0)
+        {
+            return (ssize_t)done;   // End of input
+        }
+        if (offset)
+        {
+            *offset = (off_t)off;
+        }
+        done += (size_t)n;
+    }
+#endif
+
+    return _SCOPED_copy_fallback(out_fd, in_fd, offset, count, done);
+}
+
+#endif
+
+/* Profiling zones recorded into per-thread rings */
+#ifdef SCOPED_ENABLE_ZONES
+
+#include <time.h>
+
+/* Allow user to override how many zones each thread keeps, older ones are overwritten */
+#ifndef SCOPED_ZONE_CAPACITY
+    #define SCOPED_ZONE_CAPACITY    4096
+#endif
+
+typedef struct _scoped_zone_event
+{
+    const char* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+} _scoped_zone_event;
+
+typedef struct _scoped_zone_ring
+{
+    _scoped_thread_exit_node exit;  // First, so the exit handler can cast back
+    struct _scoped_zone_ring* next; // Rings not yet released, for the exporter
+    uint64_t tid;                   // Sequential thread number used in traces
+    uint64_t head;                  // Events recorded so far, published with release
+    int finished;                   // Owner exited, freed by the next export
+    _scoped_zone_event events[SCOPED_ZONE_CAPACITY];
+} _scoped_zone_ring;
+
+typedef struct _scoped_zone_guard
+{
+    const char* name;
+    uint64_t begin_ns;
+} _scoped_zone_guard;
+
+_scoped_zone_ring* _scoped_zone_rings _SCOPED_SHARED = NULL;
+uint64_t _scoped_zone_next_tid _SCOPED_SHARED = 0;
+
+/* Calling thread's ring, created on its first zone and shared by every translation unit */
+__thread _scoped_zone_ring* _scoped_zone_self _SCOPED_SHARED = NULL;
+
+/* Raw monotonic time is not slewed by NTP, which keeps nested zones consistent */
+static inline uint64_t _SCOPED_zone_now_ns(void)
+{
+#if defined(CLOCK_MONOTONIC_RAW) || defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    #if defined(CLOCK_MONOTONIC_RAW)
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    #else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    #endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+/* The owner is gone; its events stay until they have been exported */
+static inline void _SCOPED_zone_thread_exit(_scoped_thread_exit_node* node)
+{
+    _scoped_zone_ring* ring = (_scoped_zone_ring*)node;
+
+    _scoped_zone_self = NULL;
+    __atomic_store_n(&ring->finished, 1, __ATOMIC_RELEASE);
+}
+
+static inline _scoped_zone_ring* _SCOPED_zone_ring(void)
+{
+    _scoped_zone_ring* ring = _scoped_zone_self;
+
+    if (!ring)
+    {
+        ring = (_scoped_zone_ring*)SCOPED_MALLOC_FUNC(sizeof(_scoped_zone_ring));
+        if (!ring)
+        {
+            return NULL;
+        }
+        ring->tid = __atomic_add_fetch(&_scoped_zone_next_tid, 1, __ATOMIC_RELAXED);
+        ring->head = 0;
+        ring->finished = 0;
+        _SCOPED_at_thread_exit(&ring->exit, _SCOPED_zone_thread_exit);
+
+        ring->next = __atomic_load_n(&_scoped_zone_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&_scoped_zone_rings, &ring->next, ring, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+        }
+        _scoped_zone_self = ring;
+    }
+    return ring;
+}
+
+static inline _scoped_zone_guard _SCOPED_zone_begin(const char* name)
+{
+    _scoped_zone_guard guard;
+    guard.name = name;
+    guard.begin_ns = _SCOPED_zone_now_ns();
+    return guard;
+}
+
+static inline void _SCOPED_zone_end(_scoped_zone_guard* guard)
+{
+    uint64_t end_ns = _SCOPED_zone_now_ns();
+    _scoped_zone_ring* ring = _SCOPED_zone_ring();
+
+    if (ring)
+    {
+        uint64_t head = ring->head;
+        _scoped_zone_event* event = &ring->events[head % SCOPED_ZONE_CAPACITY];
+
+        event->name = guard->name;
+        event->begin_ns = guard->begin_ns;
+        event->end_ns = end_ns;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Time the rest of the enclosing scope under the given name
+ * name must outlive the trace, typically a string literal
+ * 
+ * Example:
+ *   void handle(request* req)
+ *   {
+ *       scoped_zone("handle");
+ *       parse(req);
+ *   }
+ */
+#define scoped_zone(name)   \
+    _SCOPED(_SCOPED_zone_end) _scoped_zone_guard _SCOPED_UNIQUE(_scoped_zone_) = _SCOPED_zone_begin(name)
+
+static inline void _SCOPED_zone_write_name(FILE* out, const char* name)
+{
+    for (; *name; name++)
+    {
+        if (*name == '"' || *name == '\\')
+        {
+            fputc('\\', out);
+        }
+        if ((unsigned char)*name >= 0x20)
+        {
+            fputc(*name, out);
+        }
+    }
+}
+
+/**
+ * Write the zones recorded by every thread as Chrome trace JSON (chrome://tracing, Perfetto)
+ * Call while threads are not recording, zones being written concurrently may be torn
+ * Rings of threads that have exited are freed once written; one export at a time
+ * Returns the number of zones written
+ * 
+ * Example:
+ *   scoped_file_p trace = fopen("trace.json", "w");
+ *   scoped_zone_export_chrome(trace);
+ */
+static inline size_t scoped_zone_export_chrome(FILE* out)
+{
+    _scoped_zone_ring** link = &_scoped_zone_rings;
+    _scoped_zone_ring* ring;
+    size_t written = 0;
+
+    fputs("{\"traceEvents\":[", out);
+
+    while ((ring = __atomic_load_n(link, __ATOMIC_ACQUIRE)))
+    {
+        int finished = __atomic_load_n(&ring->finished, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t i = head > SCOPED_ZONE_CAPACITY ? head - SCOPED_ZONE_CAPACITY : 0;
+
+        for (; i < head; i++)
+        {
+            const _scoped_zone_event* event = &ring->events[i % SCOPED_ZONE_CAPACITY];
+
+            fputs(written ? ",\n{\"name\":\"" : "\n{\"name\":\"", out);
+            _SCOPED_zone_write_name(out, event->name);
+            fprintf(out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,\"ts\":%llu.%03u,\"dur\":%llu.%03u}",
+                    (unsigned long long)ring->tid,
+                    (unsigned long long)(event->begin_ns / 1000), (unsigned)(event->begin_ns % 1000),
+                    (unsigned long long)((event->end_ns - event->begin_ns) / 1000),
+                    (unsigned)((event->end_ns - event->begin_ns) % 1000));
+            written++;
+        }
+
+        /* Only the list head can race with new rings being pushed */
+        if (finished)
+        {
+            _scoped_zone_ring* expected = ring;
+            if (link != &_scoped_zone_rings)
+            {
+                *link = ring->next;
+            }
+            else if (!__atomic_compare_exchange_n(link, &expected, ring->next, 0,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            {
+                link = &ring->next;     // Freed by a later export
+                continue;
+            }
+            SCOPED_FREE_FUNC(ring);
+            continue;
+        }
+        link = &ring->next;
+    }
+
+    fputs("\n]}\n", out);
+    return written;
+}
+
+/**
+ * Discard the zones recorded by the calling thread
+ * 
+ * Example:
+ *   scoped_zone_reset();
+ */
+static inline void scoped_zone_reset(void)
+{
+    if (_scoped_zone_self)
+    {
+        __atomic_store_n(&_scoped_zone_self->head, 0, __ATOMIC_RELEASE);
+    }
+}
+
+#else
+
+/* Zones compile out entirely */
+#define scoped_zone(name)               ((void)0)
+#define scoped_zone_export_chrome(out)  ((void)(out), (size_t)0)
+#define scoped_zone_reset()             ((void)0)
+
+#endif
+
+/* Arenas as allocator contexts */
+#ifdef SCOPED_ENABLE_ALLOCATOR_CONTEXT
+
+static inline void* _SCOPED_arena_context_alloc(void* self, size_t size)
+{
+    return _SCOPED_arena_alloc((scoped_arena_t*)self, 1, size, _SCOPED_MAX_ALIGN);
+}
+
+/**
+ * Allocator context that bump-allocates from an arena
+ * Frees are no-ops; the memory returns to the system with the arena
+ * 
+ * Example:
+ *   scoped_arena arena = scoped_arena_init(0);
+ *   scoped_allocator_t from_arena = scoped_arena_allocator(&arena);
+ *   scoped_allocator_push(&from_arena);
+ *   scoped_buf(int) ids = NULL; // grows inside the arena
+ */
+static inline scoped_allocator_t scoped_arena_allocator(scoped_arena_t* arena)
+{
+    scoped_allocator_t allocator = { _SCOPED_arena_context_alloc, NULL, NULL, NULL };
+    allocator.self = arena;
+    return allocator;
+}
+
+#endif
+
+/* String builder with inline storage */
+#include <stdarg.h>
+
+/* Allow user to override how many bytes a string builder holds before it allocates */
+#ifndef SCOPED_STRBUF_INLINE
+    #define SCOPED_STRBUF_INLINE    128
+#endif
+
+typedef struct scoped_strbuf_t
+{
+    char* heap;     // NULL while the inline storage is used
+    size_t len;     // Bytes before the terminating NUL
+    size_t cap;     // Bytes available including the NUL
+    char inline_buf[SCOPED_STRBUF_INLINE];
+} scoped_strbuf_t;
+
+/* Initializer for scoped_strbuf */
+#define SCOPED_STRBUF_INIT  { NULL, 0, SCOPED_STRBUF_INLINE, { 0 } }
+
+static inline void _SCOPED_strbuf_free(scoped_strbuf_t* sb)
+{
+    if (sb->heap)
+    {
+        _SCOPED_FREE_SCOPE_EXIT(sb->heap);
+        sb->heap = NULL;    // Prevent double-free
+    }
+}
+
+/* Public macro for string builder declaration, frees its heap storage at scope exit */
+#define scoped_strbuf   _SCOPED(_SCOPED_strbuf_free) scoped_strbuf_t
+
+/* NUL-terminated contents, valid until the next append */
+#define scoped_strbuf_cstr(sb)  ((sb)->heap ? (sb)->heap : (sb)->inline_buf)
+
+/* Length of the contents, without the NUL */
+#define scoped_strbuf_len(sb)   ((sb)->len)
+
+/* Slow path: grow geometrically so that extra more bytes fit */
+static inline int _SCOPED_strbuf_grow(scoped_strbuf_t* sb, size_t extra _SCOPED_SITE_PARAMS)
+{
+    size_t need;
+    size_t new_cap = sb->cap / SCOPED_BUF_GROWTH_DEN * SCOPED_BUF_GROWTH_NUM;
+    char* data;
+
+    if (__builtin_add_overflow(sb->len, extra, &need) || __builtin_add_overflow(need, 1, &need))
+    {
+        return 0;
+    }
+    if (new_cap < need)
+    {
+        new_cap = need;
+    }
+
+    if (sb->heap)
+    {
+        data = (char*)_SCOPED_REALLOC_SITE(sb->heap, new_cap);
+    }
+    else
+    {
+        data = (char*)_SCOPED_MALLOC_SITE(new_cap);
+        if (data)
+        {
+            memcpy(data, sb->inline_buf, sb->len + 1);
+        }
+    }
+
+    if (!data)
+    {
+        return 0;
+    }
+    sb->heap = data;
+    sb->cap = new_cap;
+    return 1;
+}
+
+/**
+ * Append n bytes from s, amortized O(n)
+ * Returns nonzero on success, 0 if growing failed with the contents unchanged
+ * 
+ * Example:
+ *   scoped_strbuf_append_n(&line, method, method_len);
+ */
+static inline int _SCOPED_strbuf_append_n(scoped_strbuf_t* sb, const char* s, size_t n _SCOPED_SITE_PARAMS)
+{
+    char* data;
+
+    if (sb->cap - sb->len <= n && !_SCOPED_strbuf_grow(sb, n _SCOPED_SITE_ARGS))
+    {
+        return 0;
+    }
+    data = scoped_strbuf_cstr(sb);
+    memcpy(data + sb->len, s, n);
+    sb->len += n;
+    data[sb->len] = '\0';
+    return 1;
+}
+
+#define scoped_strbuf_append_n(sb, s, n)    _SCOPED_strbuf_append_n((sb), (s), (n) _SCOPED_SITE_HERE)
+
+/**
+ * Append a NUL-terminated string
+ * 
+ * Example:
+ *   scoped_strbuf_append(&line, "HTTP/1.1 200 OK\r\n");
+ */
+#define scoped_strbuf_append(sb, s)                                                     \
+    ({                                                                                  \
+        const char* _scoped_str = (s);                                                  \
+        _SCOPED_strbuf_append_n((sb), _scoped_str, strlen(_scoped_str) _SCOPED_SITE_HERE); \
+    })
+
+/**
+ * Append one character
+ * 
+ * Example:
+ *   scoped_strbuf_append_char(&line, '\n');
+ */
+static inline int _SCOPED_strbuf_append_char(scoped_strbuf_t* sb, char c _SCOPED_SITE_PARAMS)
+{
+    char* data;
+
+    if (sb->cap - sb->len <= 1 && !_SCOPED_strbuf_grow(sb, 1 _SCOPED_SITE_ARGS))
+    {
+        return 0;
+    }
+    data = scoped_strbuf_cstr(sb);
+    data[sb->len++] = c;
+    data[sb->len] = '\0';
+    return 1;
+}
+
+#define scoped_strbuf_append_char(sb, c)    _SCOPED_strbuf_append_char((sb), (c) _SCOPED_SITE_HERE)
+
+/**
+ * Append an unsigned integer in decimal without going through printf
+ * 
+ * Example:
+ *   scoped_strbuf_append_uint(&line, content_length);
+ */
+static inline int _SCOPED_strbuf_append_uint(scoped_strbuf_t* sb, unsigned long long value _SCOPED_SITE_PARAMS)
+{
+    char digits[20];    // Enough for 2^64 - 1
+    size_t n = sizeof(digits);
+
+    do
+    {
+        digits[--n] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    return _SCOPED_strbuf_append_n(sb, digits + n, sizeof(digits) - n _SCOPED_SITE_ARGS);
+}
+
+#define scoped_strbuf_append_uint(sb, value)    _SCOPED_strbuf_append_uint((sb), (value) _SCOPED_SITE_HERE)
+
+/**
+ * Append a signed integer in decimal without going through printf
+ * 
+ * Example:
+ *   scoped_strbuf_append_int(&line, status);
+ */
+static inline int _SCOPED_strbuf_append_int(scoped_strbuf_t* sb, long long value _SCOPED_SITE_PARAMS)
+{
+    if (value < 0)
+    {
+        /* Negate in unsigned arithmetic so LLONG_MIN does not overflow */
+        return _SCOPED_strbuf_append_char(sb, '-' _SCOPED_SITE_ARGS) &&
+               _SCOPED_strbuf_append_uint(sb, 0ull - (unsigned long long)value _SCOPED_SITE_ARGS);
+    }
+    return _SCOPED_strbuf_append_uint(sb, (unsigned long long)value _SCOPED_SITE_ARGS);
+}
+
+#define scoped_strbuf_append_int(sb, value)     _SCOPED_strbuf_append_int((sb), (value) _SCOPED_SITE_HERE)
+
+/**
+ * Append printf-style formatted text, formatting straight into the free space
+ * Returns nonzero on success, 0 on a formatting or allocation error with the contents unchanged
+ * 
+ * Example:
+ *   scoped_strbuf_appendf(&line, "%s:%d", host, port);
+ */
+static inline int _SCOPED_strbuf_appendf(scoped_strbuf_t* sb _SCOPED_SITE_PARAMS, const char* fmt, ...)
+    _SCOPED_SITE_FORMAT(2, 3);
+
+static inline int _SCOPED_strbuf_appendf(scoped_strbuf_t* sb _SCOPED_SITE_PARAMS, const char* fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(scoped_strbuf_cstr(sb) + sb->len, sb->cap - sb->len, fmt, args);
+    va_end(args);
+
+    if (n < 0)
+    {
+        scoped_strbuf_cstr(sb)[sb->len] = '\0';
+        return 0;
+    }
+
+    if ((size_t)n >= sb->cap - sb->len)
+    {
+        /* Did not fit: grow once to the exact size and format again */
+        if (!_SCOPED_strbuf_grow(sb, (size_t)n _SCOPED_SITE_ARGS))
+        {
+            scoped_strbuf_cstr(sb)[sb->len] = '\0';
+            return 0;
+        }
+        va_start(args, fmt);
+        vsnprintf(scoped_strbuf_cstr(sb) + sb->len, sb->cap - sb->len, fmt, args);
+        va_end(args);
+    }
+
+    sb->len += (size_t)n;
+    return 1;
+}
+
+#define scoped_strbuf_appendf(sb, ...)  _SCOPED_strbuf_appendf((sb) _SCOPED_SITE_HERE, __VA_ARGS__)
+
+/* Empty the builder, keeping its storage */
+static inline void scoped_strbuf_clear(scoped_strbuf_t* sb)
+{
+    sb->len = 0;
+    scoped_strbuf_cstr(sb)[0] = '\0';
+}
+
+/**
+ * Hand the contents out as a heap string and leave the builder empty
+ * Heap storage is handed over as is; inline contents are copied with one exact-size allocation
+ * Free the result with scoped_free; returns NULL if that allocation fails
+ * 
+ * Example:
+ *   char* header = scoped_strbuf_detach(&line);
+ *   scoped_free(header);
+ */
+static inline char* _SCOPED_strbuf_detach(scoped_strbuf_t* sb _SCOPED_SITE_PARAMS)
+{
+    char* data = sb->heap;
+
+    if (!data)
+    {
+        data = (char*)_SCOPED_MALLOC_SITE(sb->len + 1);
+        if (!data)
+        {
+            return NULL;
+        }
+        memcpy(data, sb->inline_buf, sb->len + 1);
+    }
+
+    sb->heap = NULL;
+    sb->len = 0;
+    sb->cap = SCOPED_STRBUF_INLINE;
+    sb->inline_buf[0] = '\0';
+    return data;
+}
+
+#define scoped_strbuf_detach(sb)    _SCOPED_strbuf_detach((sb) _SCOPED_SITE_HERE)
+
+/* Deferred calls at scope exit */
+typedef struct _scoped_defer_t
+{
+    void (*fn)(void*);
+    void* arg;
+} _scoped_defer_t;
+
+static inline void _SCOPED_defer_run(const _scoped_defer_t* defer)
+{
+    defer->fn(defer->arg);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+/* Typed trampoline per use site, so fn is called with its own signature */
+#define _SCOPED_DEFER_(fn, arg, id)                                                         \
+    auto void _SCOPED_defer_call_##id(__typeof__(0 ? (arg) : (arg)) const*);               \
+    void _SCOPED_defer_call_##id(__typeof__(0 ? (arg) : (arg)) const* _scoped_arg)         \
+    {                                                                                       \
+        (void)(fn)(*_scoped_arg);                                                           \
+    }                                                                                       \
+    _SCOPED(_SCOPED_defer_call_##id) __typeof__(0 ? (arg) : (arg)) const                   \
+        _scoped_defer_arg_##id = (arg)
+#define _SCOPED_DEFER(fn, arg, id)  _SCOPED_DEFER_(fn, arg, id)
+
+/**
+ * Call fn(arg) when the enclosing scope ends; arg is evaluated once, at the declaration
+ * fn is called with its own signature through a nested function that is only called
+ * directly, so SCOPED_DEFER(fclose, f) and SCOPED_DEFER(close, fd) need no wrapper
+ * 
+ * Example:
+ *   char* line = malloc(256);
+ *   SCOPED_DEFER(free, line);
+ */
+#define SCOPED_DEFER(fn, arg)   _SCOPED_DEFER(fn, arg, __COUNTER__)
+#else
+/**
+ * Call fn(arg) when the enclosing scope ends; without nested functions fn must be a
+ * void (*)(void*), anything else fails to compile instead of being called through a cast
+ * The guard is a constant local, so at -O1 and above the call is direct and usually inlined
+ * 
+ * Example:
+ *   char* line = malloc(256);
+ *   SCOPED_DEFER(free, line);
+ */
+#define SCOPED_DEFER(fn, arg)   \
+    _SCOPED(_SCOPED_defer_run) const _scoped_defer_t _SCOPED_UNIQUE(_scoped_defer_) = { (fn), (arg) }
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define _SCOPED_DEFER_BLOCK_(id)                                                            \
+    auto void _SCOPED_defer_block_##id(int*);                                               \
+    _SCOPED(_SCOPED_defer_block_##id) int _scoped_defer_block_##id = 0;                     \
+    void _SCOPED_defer_block_##id(int* _scoped_unused __attribute__((unused)))
+#define _SCOPED_DEFER_BLOCK(id) _SCOPED_DEFER_BLOCK_(id)
+
+/**
+ * Run the following block when the enclosing scope ends (GCC only, built on a nested function)
+ * The block sees the enclosing variables as they are at scope exit
+ * The nested function is only called directly, so no trampoline or executable stack is needed
+ * 
+ * Example:
+ *   pthread_mutex_lock(&lock);
+ *   scoped_defer
+ *   {
+ *       pthread_mutex_unlock(&lock);
+ *   }
+ */
+#define scoped_defer    _SCOPED_DEFER_BLOCK(__COUNTER__)
+#endif
+
+/* Allow user to override the largest uninitialized block each thread keeps for reuse, 0 disables reuse */
+#ifndef SCOPED_UNINIT_CACHE_MAX
+    #define SCOPED_UNINIT_CACHE_MAX     ((size_t)16 * 1024 * 1024)
+#endif
+
+/* Allow user to override the total bytes of uninitialized blocks each thread keeps */
+#ifndef SCOPED_UNINIT_CACHE_LIMIT
+    #define SCOPED_UNINIT_CACHE_LIMIT   ((size_t)32 * 1024 * 1024)
+#endif
+
+/* Blocks from 4 KiB are cached, one per power-of-two capacity range */
+#define _SCOPED_UNINIT_MIN_SHIFT    12
+#define _SCOPED_UNINIT_CLASSES      21
+
+/* Header in front of uninitialized allocations */
+typedef union _scoped_uninit_hdr
+{
+    size_t capacity;    // Usable bytes after the header
+    _scoped_max_align _align;
+} _scoped_uninit_hdr;
+
+/* Released blocks of the calling thread, their pages are already faulted in */
+typedef struct _scoped_uninit_state
+{
+    _scoped_thread_exit_node exit;
+    _scoped_uninit_hdr* blocks[_SCOPED_UNINIT_CLASSES]; // Capacity in [2^(k+12), 2^(k+13)) at index k
+    size_t bytes;       // Capacity held in blocks
+    int registered;     // Exit handler installed
+} _scoped_uninit_state;
+
+/* One cache per thread for the whole program, released when the thread exits */
+__thread _scoped_uninit_state _scoped_uninit _SCOPED_SHARED;
+
+/* Capacity range of a block of at least 4 KiB */
+static inline size_t _SCOPED_uninit_class(size_t size)
+{
+    return (size_t)(63 - __builtin_clzll((unsigned long long)size)) - _SCOPED_UNINIT_MIN_SHIFT;
+}
+
+static inline void* _SCOPED_uninit_alloc(size_t count, size_t size)
+{
+    _scoped_uninit_hdr* hdr;
+    size_t total;
+
+    if (__builtin_mul_overflow(count, size, &total) ||
+        total > SIZE_MAX - sizeof(_scoped_uninit_hdr))
+    {
+        return NULL;
+    }
+
+    /* A block from the request's range or the next one is at most four times too large */
+    if (total >= ((size_t)1 << _SCOPED_UNINIT_MIN_SHIFT) && total <= SCOPED_UNINIT_CACHE_MAX)
+    {
+        size_t k = _SCOPED_uninit_class(total);
+        size_t end = k + 2;
+
+        for (; k < end && k < _SCOPED_UNINIT_CLASSES; k++)
+        {
+            hdr = _scoped_uninit.blocks[k];
+            if (hdr && hdr->capacity >= total)
+            {
+                _scoped_uninit.blocks[k] = NULL;
+                _scoped_uninit.bytes -= hdr->capacity;
+                return hdr + 1; // Reused as is, old contents included
+            }
+        }
+    }
+
+    hdr = SCOPED_MALLOC_FUNC(sizeof(_scoped_uninit_hdr) + total);
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->capacity = total;
+    return hdr + 1;
+}
+
+static inline void scoped_uninit_flush(void);
+
+static inline void _SCOPED_uninit_exit(_scoped_thread_exit_node* node)
+{
+    (void)node;
+    scoped_uninit_flush();
+    _scoped_uninit.registered = 0;  // Blocks released by later exit handlers register again
+}
+
+static inline void _SCOPED_uninit_release(void* ptr)
+{
+    _scoped_uninit_hdr* hdr = (_scoped_uninit_hdr*)ptr - 1;
+    size_t capacity = hdr->capacity;
+
+    if (capacity >= ((size_t)1 << _SCOPED_UNINIT_MIN_SHIFT) && capacity <= SCOPED_UNINIT_CACHE_MAX &&
+        capacity <= SCOPED_UNINIT_CACHE_LIMIT - _scoped_uninit.bytes)
+    {
+        size_t k = _SCOPED_uninit_class(capacity);
+
+        if (k < _SCOPED_UNINIT_CLASSES && !_scoped_uninit.blocks[k])
+        {
+            if (!_scoped_uninit.registered)
+            {
+                _scoped_uninit.registered = 1;
+                _SCOPED_at_thread_exit(&_scoped_uninit.exit, _SCOPED_uninit_exit);
+            }
+            _scoped_uninit.blocks[k] = hdr;
+            _scoped_uninit.bytes += capacity;
+            return;
+        }
+    }
+    SCOPED_FREE_FUNC(hdr);
+}
+
+static inline void _SCOPED_uninit_free(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+        _SCOPED_uninit_release(*ptr);
+        *ptr = NULL;    // Prevent double-free
+    }
+}
+
+/* Public macro for scoped uninitialized pointer declaration */
+#define scoped_uninit_p(T)  _SCOPED(_SCOPED_uninit_free) T*
+
+/**
+ * Overflow-checked allocation whose contents are never zeroed, for buffers that are overwritten at once
+ * Each thread keeps one released block per power-of-two range from 4 KiB to SCOPED_UNINIT_CACHE_MAX,
+ * SCOPED_UNINIT_CACHE_LIMIT bytes in total, and hands it to a later request at most four times
+ * smaller, skipping the allocator and the kernel's zeroing of fresh pages
+ * 
+ * Example:
+ *   scoped_uninit_p(char) chunk = scoped_uninit_malloc(char, 8 << 20);
+ *   ssize_t n = read(fd, chunk, 8 << 20);
+ */
+#define scoped_uninit_malloc(T, count)                          \
+    ({                                                          \
+        T* _ptr = _SCOPED_uninit_alloc((count), sizeof(T));     \
+        _ptr;                                                   \
+    })
+
+/**
+ * Free an uninitialized allocation taken out of a scoped_uninit_p(T) with SCOPED_RELEASE
+ * 
+ * Example:
+ *   char* raw = SCOPED_RELEASE(chunk);
+ *   scoped_uninit_free(raw);
+ */
+static inline void scoped_uninit_free(void* ptr)
+{
+    _SCOPED_uninit_free(&ptr);
+}
+
+/**
+ * Release the blocks cached by the calling thread, this also happens when the thread exits
+ * 
+ * Example:
+ *   scoped_uninit_flush();
+ */
+static inline void scoped_uninit_flush(void)
+{
+    size_t k;
+
+    for (k = 0; k < _SCOPED_UNINIT_CLASSES; k++)
+    {
+        if (_scoped_uninit.blocks[k])
+        {
+            SCOPED_FREE_FUNC(_scoped_uninit.blocks[k]);
+            _scoped_uninit.blocks[k] = NULL;
+        }
+    }
+    _scoped_uninit.bytes = 0;
+}
+
+/**
+ * Zero size bytes at ptr in a way the compiler cannot remove as a dead store
+ * Uses explicit_bzero where the C library provides it, otherwise memset followed by a compiler barrier
+ * 
+ * Example:
+ *   unsigned char key[32];
+ *   derive(key);
+ *   scoped_secure_zero(key, sizeof(key));
+ */
+static inline void scoped_secure_zero(void* ptr, size_t size)
+{
+#if defined(__GLIBC__) && defined(_DEFAULT_SOURCE) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 25))
+    explicit_bzero(ptr, size);
+#else
+    memset(ptr, 0, size);
+    __asm__ __volatile__("" : : "r"(ptr) : "memory");   // Memory is observed, the memset stays
+#endif
+}
+
+static inline void _SCOPED_secure_release(void* ptr)
+{
+    _scoped_sized_hdr* hdr = _SCOPED_SIZED_HDR(ptr);
+    scoped_secure_zero(ptr, hdr->size - sizeof(_scoped_sized_hdr));
+    SCOPED_FREE_SIZED_FUNC(hdr, hdr->size);
+}
+
+static inline void _SCOPED_secure_free(void* p)
+{
+    void** ptr = (void**)p;
+    if (*ptr)
+    {
+        _SCOPED_secure_release(*ptr);
+        *ptr = NULL;    // Prevent double-free
+    }
+}
+
+/* Public macro for scoped secure pointer declaration, wiped before it is freed */
+#define scoped_secure_p(T)  _SCOPED(_SCOPED_secure_free) T*
+
+/**
+ * Allocation for secrets, the whole block is wiped at scope exit before it is freed
+ * There is deliberately no realloc, it would leave copies behind
+ * 
+ * Example:
+ *   scoped_secure_p(uint8_t) key = scoped_secure_malloc(uint8_t, 32);
+ */
+#define scoped_secure_malloc(T, count)                          \
+    ({                                                          \
+        T* _ptr = _SCOPED_sized_alloc((count), sizeof(T), 0);   \
+        _ptr;                                                   \
+    })
+
+/**
+ * Zero-initialized allocation for secrets
+ * 
+ * Example:
+ *   scoped_secure_p(char) password = scoped_secure_calloc(char, 128);
+ */
+#define scoped_secure_calloc(T, count)                          \
+    ({                                                          \
+        T* _ptr = _SCOPED_sized_alloc((count), sizeof(T), 1);   \
+        _ptr;                                                   \
+    })
+
+/**
+ * Wipe and free a secure allocation taken out of a scoped_secure_p(T) with SCOPED_RELEASE
+ * 
+ * Example:
+ *   uint8_t* raw = SCOPED_RELEASE(key);
+ *   scoped_secure_free(raw);
+ */
+static inline void scoped_secure_free(void* ptr)
+{
+    _SCOPED_secure_free(&ptr);
+}
+
+/* Buffered readers and writers over descriptors */
+#if SCOPED_HAS_UNISTD
+
+#include <sys/uio.h>
+
+/* Allow user to override the default buffer size of readers and writers */
+#ifndef SCOPED_IO_BUFFER_SIZE
+    #define SCOPED_IO_BUFFER_SIZE   ((size_t)1024 * 1024)
+#endif
+
+/* Allow user to override the buffer alignment, also the block size assumed for O_DIRECT */
+#ifndef SCOPED_IO_ALIGN
+    #define SCOPED_IO_ALIGN         ((size_t)4096)
+#endif
+
+/* Options for scoped_reader_open and scoped_writer_open */
+#define SCOPED_IO_DIRECT    0x01    // Bypass the page cache with O_DIRECT where supported
+
+typedef struct scoped_writer_t
+{
+    int fd;         // Owned, -1 once closed
+    int flags;      // SCOPED_IO_* options in effect
+    int error;      // errno of the first failure, later writes fail fast
+    char* buf;      // SCOPED_IO_ALIGN-aligned
+    size_t len;
+    size_t cap;
+} scoped_writer_t;
+
+typedef struct scoped_reader_t
+{
+    int fd;         // Owned, -1 once closed
+    int flags;      // SCOPED_IO_* options in effect
+    int error;      // errno of the first failure
+    char* buf;      // SCOPED_IO_ALIGN-aligned
+    size_t pos;     // Next unread byte
+    size_t len;     // End of buffered data
+    size_t cap;
+} scoped_reader_t;
+
+/* Turn O_DIRECT on or off for fd, 0 on success */
+static inline int _SCOPED_io_set_direct(int fd, int on)
+{
+#if defined(O_DIRECT)
+    int fl = fcntl(fd, F_GETFL);
+    if (fl < 0)
+    {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, on ? (fl | O_DIRECT) : (fl & ~O_DIRECT));
+#else
+    (void)fd;
+    (void)on;
+    return -1;
+#endif
+}
+
+static inline int _SCOPED_io_setup(int fd, int flags, size_t* cap, char** buf)
+{
+    size_t size = *cap ? *cap : SCOPED_IO_BUFFER_SIZE;
+
+    if (size > SIZE_MAX - SCOPED_IO_ALIGN)
+    {
+        *buf = NULL;
+        return 0;
+    }
+    *cap = _SCOPED_ALIGN_UP(size, SCOPED_IO_ALIGN);
+    *buf = (char*)_SCOPED_aligned_alloc(1, *cap, SCOPED_IO_ALIGN, 0);
+
+    if ((flags & SCOPED_IO_DIRECT) && fd >= 0 && _SCOPED_io_set_direct(fd, 1) != 0)
+    {
+        flags &= ~SCOPED_IO_DIRECT; // Filesystem or platform without O_DIRECT
+    }
+    return flags;
+}
+
+/* Write every iovec, resuming after short writes */
+static inline int _SCOPED_writev_all(int fd, struct iovec* iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+/* Write out buffered bytes; with O_DIRECT only whole blocks unless final */
+static inline int _SCOPED_writer_drain(scoped_writer_t* w, int final)
+{
+    size_t n = w->len;
+
+    if (w->error || w->fd < 0)
+    {
+        return -1;
+    }
+
+    if (w->flags & SCOPED_IO_DIRECT)
+    {
+        n -= n % SCOPED_IO_ALIGN;
+        if (n && _SCOPED_write_all(w->fd, w->buf, n) != 0)
+        {
+            if (errno != EINVAL)
+            {
+                w->error = errno;
+                return -1;
+            }
+            n = 0;  // Misaligned file offset, continue through the page cache
+            final = 1;
+        }
+        if (!final)
+        {
+            memmove(w->buf, w->buf + n, w->len - n);
+            w->len -= n;
+            return 0;
+        }
+
+        /* The tail is not a whole block, write it without O_DIRECT */
+        _SCOPED_io_set_direct(w->fd, 0);
+        w->flags &= ~SCOPED_IO_DIRECT;
+        memmove(w->buf, w->buf + n, w->len - n);
+        w->len -= n;
+        n = w->len;
+    }
+
+    if (n && _SCOPED_write_all(w->fd, w->buf, n) != 0)
+    {
+        w->error = errno;
+        return -1;
+    }
+    w->len = 0;
+    return 0;
+}
+
+/**
+ * Flush and close the writer's descriptor, and free its buffer
+ * Returns 0, or -1 with errno set if any write failed
+ * 
+ * Example:
+ *   if (scoped_writer_close(&out) != 0) perror("write");
+ */
+static inline int scoped_writer_close(scoped_writer_t* w)
+{
+    if (w->fd >= 0)
+    {
+        _SCOPED_writer_drain(w, 1);
+        if (close(w->fd) != 0 && !w->error)
+        {
+            w->error = errno;
+        }
+        w->fd = -1;
+    }
+    _SCOPED_aligned_free(&w->buf);
+    if (w->error)
+    {
+        errno = w->error;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void _SCOPED_writer_close(scoped_writer_t* w)
+{
+    scoped_writer_close(w);
+}
+
+/* Public macro for buffered writer declaration, flushes and closes at scope exit */
+#define scoped_writer   _SCOPED(_SCOPED_writer_close) scoped_writer_t
+
+/**
+ * Wrap fd in a buffered writer that takes ownership of it
+ * buffer_size 0 selects SCOPED_IO_BUFFER_SIZE; it is rounded up to SCOPED_IO_ALIGN
+ * With SCOPED_IO_DIRECT, the file position should be block-aligned (e.g. a new file)
+ * 
+ * Example:
+ *   scoped_writer out = scoped_writer_open(open("ingest.log", O_WRONLY | O_CREAT | O_APPEND, 0644), 0, 0);
+ *   scoped_writer_write(&out, line, len);
+ */
+static inline scoped_writer_t scoped_writer_open(int fd, size_t buffer_size, int flags)
+{
+    scoped_writer_t w;
+
+    w.fd = fd;
+    w.len = 0;
+    w.cap = buffer_size;
+    w.flags = _SCOPED_io_setup(fd, flags, &w.cap, &w.buf);
+    w.error = fd < 0 ? EBADF : (w.buf ? 0 : ENOMEM);
+    return w;
+}
+
+/**
+ * Write n bytes through the buffer
+ * Data that does not fit goes out together with the buffered bytes in one writev, without copying
+ * Returns 0, or -1 once any write has failed
+ * 
+ * Example:
+ *   scoped_writer_write(&out, record, record_len);
+ */
+static inline int scoped_writer_write(scoped_writer_t* w, const void* data, size_t n)
+{
+    const char* src = (const char*)data;
+
+    if (w->error)
+    {
+        return -1;
+    }
+
+    if (n <= w->cap - w->len)
+    {
+        memcpy(w->buf + w->len, src, n);
+        w->len += n;
+        return 0;
+    }
+
+    if (!(w->flags & SCOPED_IO_DIRECT))
+    {
+        struct iovec iov[2];
+        iov[0].iov_base = w->buf;
+        iov[0].iov_len = w->len;
+        iov[1].iov_base = (void*)src;
+        iov[1].iov_len = n;
+        if (_SCOPED_writev_all(w->fd, iov, 2) != 0)
+        {
+            w->error = errno;
+            return -1;
+        }
+        w->len = 0;
+        return 0;
+    }
+
+    /* O_DIRECT only accepts aligned memory, stage everything in the buffer */
+    while (n > 0)
+    {
+        size_t chunk = n < w->cap - w->len ? n : w->cap - w->len;
+        memcpy(w->buf + w->len, src, chunk);
+        w->len += chunk;
+        src += chunk;
+        n -= chunk;
+        if (w->len == w->cap && _SCOPED_writer_drain(w, 0) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write a NUL-terminated string
+ * 
+ * Example:
+ *   scoped_writer_puts(&out, "done\n");
+ */
+static inline int scoped_writer_puts(scoped_writer_t* w, const char* s)
+{
+    return scoped_writer_write(w, s, strlen(s));
+}
+
+/**
+ * Write one byte
+ * 
+ * Example:
+ *   scoped_writer_putc(&out, '\n');
+ */
+static inline int scoped_writer_putc(scoped_writer_t* w, char c)
+{
+    if (w->len < w->cap && !w->error)
+    {
+        w->buf[w->len++] = c;
+        return 0;
+    }
+    return scoped_writer_write(w, &c, 1);
+}
+
+/**
+ * Write out everything buffered
+ * With O_DIRECT, a trailing partial block stays buffered until the writer is closed
+ * 
+ * Example:
+ *   scoped_writer_flush(&out);
+ */
+static inline int scoped_writer_flush(scoped_writer_t* w)
+{
+    return _SCOPED_writer_drain(w, 0);
+}
+
+/**
+ * Close the reader's descriptor and free its buffer
+ * 
+ * Example:
+ *   scoped_reader_close(&in);
+ */
+static inline void scoped_reader_close(scoped_reader_t* r)
+{
+    _SCOPED_close(&r->fd);
+    _SCOPED_aligned_free(&r->buf);
+}
+
+/* Public macro for buffered reader declaration, closes at scope exit */
+#define scoped_reader   _SCOPED(scoped_reader_close) scoped_reader_t
+
+/**
+ * Wrap fd in a buffered reader that takes ownership of it
+ * buffer_size 0 selects SCOPED_IO_BUFFER_SIZE; it is rounded up to SCOPED_IO_ALIGN
+ * 
+ * Example:
+ *   scoped_reader in = scoped_reader_open(open("ingest.log", O_RDONLY), 0, SCOPED_IO_DIRECT);
+ */
+static inline scoped_reader_t scoped_reader_open(int fd, size_t buffer_size, int flags)
+{
+    scoped_reader_t r;
+
+    r.fd = fd;
+    r.pos = 0;
+    r.len = 0;
+    r.cap = buffer_size;
+    r.flags = _SCOPED_io_setup(fd, flags, &r.cap, &r.buf);
+    r.error = fd < 0 ? EBADF : (r.buf ? 0 : ENOMEM);
+    return r;
+}
+
+/* Keep unread bytes and read more behind them; > 0 bytes added, 0 at end of input, -1 on error */
+static inline ssize_t _SCOPED_reader_fill(scoped_reader_t* r)
+{
+    size_t keep = r->len - r->pos;
+    size_t start = 0;
+    ssize_t n;
+
+    if (r->error)
+    {
+        return -1;
+    }
+
+    /* O_DIRECT reads must start on a block boundary, so the kept bytes end on one */
+    if (r->flags & SCOPED_IO_DIRECT)
+    {
+        start = _SCOPED_ALIGN_UP(keep, SCOPED_IO_ALIGN) - keep;
+    }
+    memmove(r->buf + start, r->buf + r->pos, keep);
+    r->pos = start;
+    r->len = start + keep;
+
+    if (r->len == r->cap)
+    {
+        return 0;   // No room left, caller handles a full buffer
+    }
+
+    do
+    {
+        n = read(r->fd, r->buf + r->len, r->cap - r->len);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+    {
+        r->error = errno;
+        return -1;
+    }
+    r->len += (size_t)n;
+    return n;
+}
+
+/**
+ * Read up to n bytes, stopping early only at end of input
+ * When the buffer is empty, one readv fills dst and refills the buffer together
+ * Returns the number of bytes read, 0 at end of input, or -1 if an error occurred before any byte was read
+ * 
+ * Example:
+ *   char block[512];
+ *   ssize_t n = scoped_reader_read(&in, block, sizeof(block));
+ */
+static inline ssize_t scoped_reader_read(scoped_reader_t* r, void* dst, size_t n)
+{
+    char* out = (char*)dst;
+    size_t done = 0;
+
+    while (done < n && !r->error)
+    {
+        ssize_t got;
+
+        if (r->pos < r->len)
+        {
+            size_t chunk = r->len - r->pos < n - done ? r->len - r->pos : n - done;
+            memcpy(out + done, r->buf + r->pos, chunk);
+            r->pos += chunk;
+            done += chunk;
+            continue;
+        }
+
+        if (r->flags & SCOPED_IO_DIRECT)
+        {
+            r->pos = r->len = 0;
+            got = _SCOPED_reader_fill(r);
+        }
+        else
+        {
+            struct iovec iov[2];
+            iov[0].iov_base = out + done;
+            iov[0].iov_len = n - done;
+            iov[1].iov_base = r->buf;
+            iov[1].iov_len = r->cap;
+
+            got = readv(r->fd, iov, 2);
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got < 0)
+            {
+                r->error = errno;
+            }
+            else if ((size_t)got <= n - done)
+            {
+                done += (size_t)got;
+            }
+            else
+            {
+                r->pos = 0;
+                r->len = (size_t)got - (n - done);
+                done = n;
+            }
+        }
+
+        if (got <= 0)
+        {
+            break;  // End of input or error
+        }
+    }
+
+    return done ? (ssize_t)done : (r->error ? -1 : 0);
+}
+
+/**
+ * Read one byte, or -1 at end of input or on error
  * 
  * Example:
- *   scoped_int_t arr = scoped_malloc(int, 10);
- *   // arr is automatically freed when it goes out of scope
+ *   int c;
+ *   while ((c = scoped_reader_getc(&in)) >= 0) count[c]++;
  */
-#define scoped_malloc(T, count)                             \
-    ({                                                      \
-        T* _ptr = SCOPED_MALLOC_FUNC((count) * sizeof(T));  \
-        _ptr;                                               \
-    })
+static inline int scoped_reader_getc(scoped_reader_t* r)
+{
+    if (r->pos == r->len && _SCOPED_reader_fill(r) <= 0)
+    {
+        return -1;
+    }
+    return (unsigned char)r->buf[r->pos++];
+}
 
 /**
- * Safe calloc using custom allocator
+ * Return the next line, newline included, as a pointer into the buffer valid until the next read
+ * The last line may lack a newline; lines longer than the buffer come back in buffer-sized pieces
+ * Returns NULL at end of input or on error
  * 
  * Example:
- *   scoped_int_t arr = scoped_calloc(int, 10);
+ *   size_t len;
+ *   const char* line;
+ *   while ((line = scoped_reader_line(&in, &len))) ingest(line, len);
  */
-#define scoped_calloc(T, count)                             \
-    ({                                                      \
-        T* _ptr = SCOPED_CALLOC_FUNC((count), sizeof(T));   \
-        _ptr;                                               \
-    })
+static inline const char* scoped_reader_line(scoped_reader_t* r, size_t* len)
+{
+    size_t scanned = 0; // Bytes after pos already searched, stays valid when fill moves them
+    const char* line;
+
+    for (;;)
+    {
+        size_t avail = r->len - r->pos;
+        const char* nl = (const char*)memchr(r->buf + r->pos + scanned, '\n', avail - scanned);
+        ssize_t got;
+
+        if (nl)
+        {
+            *len = (size_t)(nl + 1 - (r->buf + r->pos));
+            break;
+        }
+
+        got = _SCOPED_reader_fill(r);
+        if (got > 0)
+        {
+            scanned = avail;
+            continue;
+        }
+        if (got < 0 || r->pos == r->len)
+        {
+            return NULL;    // Error, or end of input with nothing left
+        }
+        *len = r->len - r->pos; // Last line without a newline, or a full buffer
+        break;
+    }
+
+    line = r->buf + r->pos;
+    r->pos += *len;
+    return line;
+}
+
+#endif
+
+/* Work-stealing thread pool and task groups joined at scope exit */
+#if SCOPED_HAS_PTHREAD
+
+/* Allow user to override how many tasks each worker queue holds, a power of two */
+#ifndef SCOPED_TASK_QUEUE_SIZE
+    #define SCOPED_TASK_QUEUE_SIZE  1024
+#endif
+
+struct scoped_task_group_t;
+
+typedef struct _scoped_task
+{
+    void (*fn)(void*);                          // Plain task, or NULL for a range task
+    void (*range_fn)(void*, size_t, size_t);
+    void* arg;
+    size_t begin;
+    size_t end;
+    struct scoped_task_group_t* group;
+} _scoped_task;
+
+/* Per-worker queue: the owner pushes and pops at the tail, thieves take from the head */
+typedef struct __attribute__((aligned(SCOPED_CACHE_LINE_SIZE))) _scoped_task_queue
+{
+    scoped_spinlock_t lock;
+    size_t head;
+    size_t tail;
+    _scoped_task* tasks[SCOPED_TASK_QUEUE_SIZE];
+} _scoped_task_queue;
+
+typedef struct scoped_thread_pool_t
+{
+    _scoped_task_queue* queues;     // One per worker, plus a shared one at [workers] for outside threads
+    pthread_t* threads;
+    size_t workers;
+    size_t started;                 // Worker indices handed out
+    size_t queued;                  // Tasks sitting in queues
+    int sleepers;                   // Workers blocked on wake
+    int joiners;                    // Group waiters blocked on done
+    int stop;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;            // Broadcast when a group's last task finishes
+} scoped_thread_pool_t;
+
+typedef struct scoped_task_group_t
+{
+    scoped_thread_pool_t* pool;     // NULL runs every task inline
+    size_t pending;                 // Spawned tasks not finished yet
+} scoped_task_group_t;
+
+/* Pool and queue index of the calling worker thread, seen by every translation unit */
+__thread scoped_thread_pool_t* _scoped_worker_pool _SCOPED_SHARED = NULL;
+__thread size_t _scoped_worker_index _SCOPED_SHARED = 0;
+
+static inline int _SCOPED_task_queue_push(_scoped_task_queue* q, _scoped_task* task)
+{
+    scoped_spin_lock(&q->lock);
+    if (q->tail - q->head == SCOPED_TASK_QUEUE_SIZE)
+    {
+        return 0;
+    }
+    q->tasks[q->tail % SCOPED_TASK_QUEUE_SIZE] = task;
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* Take from the tail (newest, still hot in cache) or the head (oldest, for thieves) */
+static inline _scoped_task* _SCOPED_task_queue_take(_scoped_task_queue* q, int newest)
+{
+    if (__atomic_load_n(&q->head, __ATOMIC_RELAXED) == __atomic_load_n(&q->tail, __ATOMIC_RELAXED))
+    {
+        return NULL;    // Skip the lock when the queue looks empty
+    }
+
+    {
+        scoped_spin_lock(&q->lock);
+        if (q->head == q->tail)
+        {
+            return NULL;
+        }
+        if (newest)
+        {
+            __atomic_store_n(&q->tail, q->tail - 1, __ATOMIC_RELAXED);
+            return q->tasks[q->tail % SCOPED_TASK_QUEUE_SIZE];
+        }
+        __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELAXED);
+        return q->tasks[(q->head - 1) % SCOPED_TASK_QUEUE_SIZE];
+    }
+}
+
+/* Own queue first, then the shared queue, then steal from the other workers */
+static inline _scoped_task* _SCOPED_task_find(scoped_thread_pool_t* pool, size_t self)
+{
+    _scoped_task* task = NULL;
+    size_t i;
+
+    if (self < pool->workers)
+    {
+        task = _SCOPED_task_queue_take(&pool->queues[self], 1);
+    }
+    for (i = 0; !task && i <= pool->workers; i++)
+    {
+        size_t victim = (self + 1 + i) % (pool->workers + 1);
+        task = _SCOPED_task_queue_take(&pool->queues[victim], 0);
+    }
+
+    if (task)
+    {
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+static inline void _SCOPED_task_run(_scoped_task* task)
+{
+    scoped_task_group_t* group = task->group;
+    scoped_thread_pool_t* pool = group->pool;
+
+    if (task->fn)
+    {
+        task->fn(task->arg);
+    }
+    else
+    {
+        task->range_fn(task->arg, task->begin, task->end);
+    }
+    _SCOPED_FREE(task);
+
+    /* The group may be gone once pending reaches 0, only the pool is touched after this */
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&pool->joiners, __ATOMIC_SEQ_CST))
+    {
+        scoped_lock(&pool->sleep_lock);
+        pthread_cond_broadcast(&pool->done);
+    }
+}
+
+static inline void* _SCOPED_thread_pool_worker(void* arg)
+{
+    scoped_thread_pool_t* pool = (scoped_thread_pool_t*)arg;
+    size_t self;
+
+    self = __atomic_fetch_add(&pool->started, 1, __ATOMIC_RELAXED);
+    _scoped_worker_pool = pool;
+    _scoped_worker_index = self;
+
+    for (;;)
+    {
+        _scoped_task* task = _SCOPED_task_find(pool, self);
+        int spins;
+
+        if (task)
+        {
+            _SCOPED_task_run(task);
+            continue;
+        }
+
+        for (spins = 0; spins < SCOPED_SPIN_LIMIT && !__atomic_load_n(&pool->queued, __ATOMIC_RELAXED); spins++)
+        {
+            _SCOPED_CPU_RELAX();
+        }
+        if (__atomic_load_n(&pool->queued, __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+
+        {
+            scoped_lock(&pool->sleep_lock);
+            __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+            while (!pool->stop && !__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST))
+            {
+                pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+            }
+            __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_RELAXED);
+            if (pool->stop && !__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST))
+            {
+                break;
+            }
+        }
+    }
+
+    return NULL;    // Thread caches holding task blocks are flushed at thread exit
+}
+
+static inline void _SCOPED_thread_pool_stop(scoped_thread_pool_t* pool, size_t started)
+{
+    size_t i;
+
+    pthread_mutex_lock(&pool->sleep_lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->sleep_lock);
+    SCOPED_ALIGNED_FREE_FUNC(pool->queues);
+    SCOPED_FREE_FUNC(pool->threads);
+    SCOPED_FREE_FUNC(pool);
+}
 
 /**
- * Safe realloc using custom allocator
+ * Start a pool of worker threads, 0 starts one per online CPU
+ * Returns NULL on failure
  * 
- * Note: If realloc fails, the original pointer remains unchanged
+ * Example:
+ *   scoped_thread_pool pool = scoped_thread_pool_create(0);
+ */
+static inline scoped_thread_pool_t* scoped_thread_pool_create(size_t workers)
+{
+    scoped_thread_pool_t* pool;
+    size_t i;
+
+    if (workers == 0)
+    {
+#if SCOPED_HAS_UNISTD && defined(_SC_NPROCESSORS_ONLN)
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (size_t)cpus : 1;
+#else
+        workers = 1;
+#endif
+    }
+
+    pool = (scoped_thread_pool_t*)SCOPED_CALLOC_FUNC(1, sizeof(scoped_thread_pool_t));
+    if (!pool)
+    {
+        return NULL;
+    }
+    pool->workers = workers;
+    pool->threads = (pthread_t*)SCOPED_CALLOC_FUNC(workers, sizeof(pthread_t));
+    pool->queues = (_scoped_task_queue*)_SCOPED_aligned_alloc(workers + 1, sizeof(_scoped_task_queue),
+                                                              SCOPED_CACHE_LINE_SIZE, 1);
+    if (!pool->threads || !pool->queues)
+    {
+        _SCOPED_aligned_free(&pool->queues);
+        SCOPED_FREE_FUNC(pool->threads);
+        SCOPED_FREE_FUNC(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i = 0; i < workers; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, _SCOPED_thread_pool_worker, pool) != 0)
+        {
+            _SCOPED_thread_pool_stop(pool, i);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+/**
+ * Run the remaining tasks, stop the workers and free the pool
  * 
  * Example:
- *   scoped_int_t arr = scoped_malloc(int, 10);
- *   if (!scoped_realloc(arr, 20))
+ *   scoped_thread_pool_t* raw = SCOPED_RELEASE(pool);
+ *   scoped_thread_pool_destroy(raw);
+ */
+static inline void scoped_thread_pool_destroy(scoped_thread_pool_t* pool)
+{
+    if (pool)
+    {
+        _SCOPED_thread_pool_stop(pool, pool->workers);
+    }
+}
+
+static inline void _SCOPED_thread_pool_destroy(scoped_thread_pool_t** pool)
+{
+    scoped_thread_pool_destroy(*pool);
+    *pool = NULL;   // Prevent double-destroy
+}
+
+/* Public macro for thread pool declaration, stops the workers at scope exit */
+#define scoped_thread_pool  _SCOPED(_SCOPED_thread_pool_destroy) scoped_thread_pool_t*
+
+static inline void _SCOPED_task_submit(scoped_task_group_t* group, _scoped_task* task)
+{
+    scoped_thread_pool_t* pool = group->pool;
+    size_t queue = _scoped_worker_pool == pool ? _scoped_worker_index : pool->workers;
+
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+    if (!_SCOPED_task_queue_push(&pool->queues[queue], task))
+    {
+        _SCOPED_task_run(task); // Queue full, run it here
+        return;
+    }
+
+    /* Paired with the sleeper's increment then check, one of the two sees the other */
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST))
+    {
+        scoped_lock(&pool->sleep_lock);
+        pthread_cond_signal(&pool->wake);
+    }
+}
+
+static inline _scoped_task* _SCOPED_task_new(scoped_task_group_t* group)
+{
+    _scoped_task* task = group->pool ? (_scoped_task*)_SCOPED_MALLOC(sizeof(_scoped_task)) : NULL;
+    if (task)
+    {
+        task->group = group;
+    }
+    return task;
+}
+
+/**
+ * Run fn(arg) on the group's pool
+ * Runs inline if the group has no pool or the task cannot be queued
+ * 
+ * Example:
+ *   scoped_task_spawn(&group, compress_block, &blocks[i]);
+ */
+static inline void scoped_task_spawn(scoped_task_group_t* group, void (*fn)(void*), void* arg)
+{
+    _scoped_task* task = _SCOPED_task_new(group);
+
+    if (!task)
+    {
+        fn(arg);
+        return;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    _SCOPED_task_submit(group, task);
+}
+
+/**
+ * Split [begin, end) into chunks of at most grain indices and run fn(arg, chunk_begin, chunk_end) for each
+ * 
+ * Example:
+ *   static void scale(void* arg, size_t begin, size_t end)
  *   {
- *       // Handle allocation failure - original memory still valid
+ *       float* v = arg;
+ *       for (size_t i = begin; i < end; i++) v[i] *= 2.0f;
  *   }
+ *   scoped_task_parallel_for(&group, 0, n, 16384, scale, values);
  */
-#define scoped_realloc(scoped_var, new_count)                                                               \
-    ({                                                                                                      \
-        __typeof__(*(scoped_var))* _old_ptr = (scoped_var);                                                 \
-        __typeof__(*_old_ptr)* _new_ptr = SCOPED_REALLOC_FUNC(_old_ptr, (new_count) * sizeof(*_old_ptr));   \
-        if (_new_ptr)                                                                                       \
-        {                                                                                                   \
-            (scoped_var) = _new_ptr;                                                                        \
-        }                                                                                                   \
-        _new_ptr;                                                                                           \
-    })
+static inline void scoped_task_parallel_for(scoped_task_group_t* group, size_t begin, size_t end, size_t grain,
+                                            void (*fn)(void*, size_t, size_t), void* arg)
+{
+    if (grain == 0)
+    {
+        grain = 1;
+    }
+
+    while (begin < end)
+    {
+        size_t chunk_end = end - begin > grain ? begin + grain : end;
+        _scoped_task* task = _SCOPED_task_new(group);
+
+        if (!task)
+        {
+            fn(arg, begin, chunk_end);
+        }
+        else
+        {
+            task->fn = NULL;
+            task->range_fn = fn;
+            task->arg = arg;
+            task->begin = begin;
+            task->end = chunk_end;
+            _SCOPED_task_submit(group, task);
+        }
+        begin = chunk_end;
+    }
+}
+
+/**
+ * Wait for every task of the group, running queued tasks meanwhile
+ * Once no task is left to help with, spins SCOPED_SPIN_LIMIT times and then sleeps
+ * until the group's last task finishes
+ * 
+ * Example:
+ *   scoped_task_group_wait(&group);
+ */
+static inline void scoped_task_group_wait(scoped_task_group_t* group)
+{
+    scoped_thread_pool_t* pool = group->pool;
+    size_t self;
+    int spins = 0;
+
+    if (!pool)
+    {
+        return;
+    }
+    self = _scoped_worker_pool == pool ? _scoped_worker_index : pool->workers;
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE))
+    {
+        _scoped_task* task = _SCOPED_task_find(pool, self);
+        if (task)
+        {
+            _SCOPED_task_run(task); // Help instead of blocking
+            spins = 0;
+            continue;
+        }
+        if (++spins < SCOPED_SPIN_LIMIT)
+        {
+            _SCOPED_CPU_RELAX();
+            continue;
+        }
+
+        /* The remaining tasks run elsewhere; paired with the decrement then check in _SCOPED_task_run */
+        {
+            scoped_lock(&pool->sleep_lock);
+            __atomic_add_fetch(&pool->joiners, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST))
+            {
+                pthread_cond_wait(&pool->done, &pool->sleep_lock);
+            }
+            __atomic_sub_fetch(&pool->joiners, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Public macro for task group declaration, joins every task at scope exit */
+#define scoped_task_group   _SCOPED(scoped_task_group_wait) scoped_task_group_t
+
+/**
+ * Task group running on pool, NULL runs tasks inline
+ * Declare the group after the pool so it is joined first
+ * 
+ * Example:
+ *   {
+ *       scoped_task_group group = scoped_task_group_init(pool);
+ *       for (size_t i = 0; i < n; i++) scoped_task_spawn(&group, work, &items[i]);
+ *   } // every task has finished here
+ */
+#define scoped_task_group_init(pool)  ((scoped_task_group_t){ (pool), 0 })
+
+#endif
+
+/* Cleanup picked at compile time from the type of the initializer */
+
+/* Cleanups taking the address of the variable as void*, so one guard type fits them all */
+static inline void _SCOPED_auto_free(void* p)
+{
+    _SCOPED_free(p);
+}
+
+static inline void _SCOPED_auto_fclose(void* p)
+{
+    _SCOPED_fclose((FILE**)p);
+}
+
+static inline void _SCOPED_auto_arena(void* p)
+{
+    _SCOPED_arena_destroy((scoped_arena_t*)p);
+}
+
+static inline void _SCOPED_auto_strbuf(void* p)
+{
+    _SCOPED_strbuf_free((scoped_strbuf_t*)p);
+}
+
+#define _SCOPED_AUTO_STD_TYPES                                                          \
+    void*: _SCOPED_auto_free, char*: _SCOPED_auto_free,                                 \
+    signed char*: _SCOPED_auto_free, unsigned char*: _SCOPED_auto_free,                 \
+    short*: _SCOPED_auto_free, unsigned short*: _SCOPED_auto_free,                      \
+    int*: _SCOPED_auto_free, unsigned int*: _SCOPED_auto_free,                          \
+    long*: _SCOPED_auto_free, unsigned long*: _SCOPED_auto_free,                        \
+    long long*: _SCOPED_auto_free, unsigned long long*: _SCOPED_auto_free,              \
+    float*: _SCOPED_auto_free, double*: _SCOPED_auto_free,                              \
+    long double*: _SCOPED_auto_free,                                                    \
+    FILE*: _SCOPED_auto_fclose,                                                         \
+    scoped_arena_t: _SCOPED_auto_arena,                                                 \
+    scoped_strbuf_t: _SCOPED_auto_strbuf,
+
+#if SCOPED_HAS_UNISTD
+/* Owned descriptor for scoped_auto; a plain int is a count or flag as often as a descriptor */
+typedef struct scoped_fd_t
+{
+    int fd;         // -1 when closed
+} scoped_fd_t;
+
+/* Wrap a descriptor so scoped_auto closes it, e.g. scoped_auto(f, SCOPED_FD(open(path, O_RDONLY))) */
+#define SCOPED_FD(fd) ((scoped_fd_t){ (fd) })
+
+static inline void _SCOPED_auto_close(void* p)
+{
+    _SCOPED_close(&((scoped_fd_t*)p)->fd);
+}
+
+static inline void _SCOPED_auto_fdset(void* p)
+{
+    _SCOPED_fdset_free((scoped_fdset_t*)p);
+}
+
+static inline void _SCOPED_auto_pipe(void* p)
+{
+    _SCOPED_pipe_close((scoped_pipe_t*)p);
+}
+
+static inline void _SCOPED_auto_writer(void* p)
+{
+    _SCOPED_writer_close((scoped_writer_t*)p);
+}
+
+static inline void _SCOPED_auto_reader(void* p)
+{
+    scoped_reader_close((scoped_reader_t*)p);
+}
+
+#define _SCOPED_AUTO_FD_TYPES                                                           \
+    scoped_fd_t: _SCOPED_auto_close,                                                    \
+    scoped_fdset_t: _SCOPED_auto_fdset,                                                 \
+    scoped_pipe_t: _SCOPED_auto_pipe,                                                   \
+    scoped_writer_t: _SCOPED_auto_writer,                                               \
+    scoped_reader_t: _SCOPED_auto_reader,
+#else
+#define _SCOPED_AUTO_FD_TYPES
+#endif
+
+#if SCOPED_HAS_MMAP && SCOPED_HAS_UNISTD
+static inline void _SCOPED_auto_munmap(void* p)
+{
+    _SCOPED_munmap((scoped_mmap_t*)p);
+}
+
+#define _SCOPED_AUTO_MMAP_TYPES scoped_mmap_t: _SCOPED_auto_munmap,
+#else
+#define _SCOPED_AUTO_MMAP_TYPES
+#endif
+
+/* Associations for registered types, listed in SCOPED_AUTO_TYPES */
+#define SCOPED_AUTO_TYPE(T)     T: _SCOPED_##T##_AUTO,
+#define SCOPED_AUTO_TYPE_PTR(T) T*: _SCOPED_##T##_PTR_AUTO,
+
+/* Allow user to list registered types for scoped_auto, e.g. SCOPED_AUTO_TYPE(conn) SCOPED_AUTO_TYPE_PTR(session) */
+#ifndef SCOPED_AUTO_TYPES
+    #define SCOPED_AUTO_TYPES
+#endif
+
+/* Selected for types without a cleanup, so the guard initializer fails to compile */
+extern struct _scoped_auto_unsupported_type _scoped_auto_unsupported_type;
+
+#define _SCOPED_AUTO_FUNC(var)                                                          \
+    __extension__ _Generic((var),                                                       \
+        SCOPED_AUTO_TYPES                                                               \
+        _SCOPED_AUTO_STD_TYPES                                                          \
+        _SCOPED_AUTO_FD_TYPES                                                           \
+        _SCOPED_AUTO_MMAP_TYPES                                                         \
+        default: _scoped_auto_unsupported_type)
+
+/**
+ * Declare name with the type of expr, initialize it with expr, and clean it up at scope exit
+ * The cleanup is chosen at compile time from the type: pointers to standard scalar types are
+ * freed, FILE* is closed with fclose, and the scoped arena, string builder, descriptor, descriptor
+ * set, pipe, reader, writer and mapping types are released. A bare int has no cleanup; wrap a
+ * descriptor with SCOPED_FD so a count or flag is never closed.
+ * Registered types are added through SCOPED_AUTO_TYPES. The guard holds a constant function
+ * pointer, so the cleanup is inlined and its NULL check folded where the value is known
+ * 
+ * Example:
+ *   scoped_auto(f, fopen(path, "r"));          // FILE*, fclose at scope exit
+ *   scoped_auto(f2, SCOPED_FD(open(path, O_RDONLY)));  // scoped_fd_t, close at scope exit
+ *   scoped_auto(buf, scoped_malloc(char, 4096));
+ */
+#define scoped_auto(name, expr)                                                         \
+    __typeof__(expr) name = (expr);                                                     \
+    _SCOPED(_SCOPED_defer_run) const _scoped_defer_t _SCOPED_UNIQUE(_scoped_auto_) =    \
+        { _SCOPED_AUTO_FUNC(name), (void*)&(name) }
 
 #endif /* SCOPED_H */